@@ -0,0 +1,219 @@
+// Packs the game assets into a single archive (see iPack.h) that the game memory maps at startup.
+// Images are decoded, flipped for OpenGL, and sprites are resized to the tile size ahead of time,
+// so the game does no PNG decoding or resizing when the archive is present.
+//
+// Build and run from the project root:
+//   g++ -O2 -I. -IOpenGL/include helpers/asset_packer.cpp -o bin/asset_packer
+//   ./bin/asset_packer [--raw] [output path, default assets/assets.pack]
+//
+// --raw stores every image uncompressed, so it is used straight from the mapping. By default
+// images are LZ4-compressed when that saves at least a quarter of their size.
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "iPack.h"
+#include "iPixels.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define SPRITE_SIZE 40 // Must match TILE_SIZE in iMain.cpp.
+
+struct PackItem
+{
+    PackEntry entry;
+    std::vector<unsigned char> data;
+};
+
+bool hasExtension(const char *name, const char *extension)
+{
+    const char *ext = strrchr(name, '.');
+    return ext && strcmp(ext, extension) == 0;
+}
+
+bool readFile(const char *path, std::vector<unsigned char> &data)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data.resize(size);
+    bool ok = fread(data.data(), 1, size, file) == (size_t)size;
+    fclose(file);
+    return ok;
+}
+
+void storeData(PackItem &item, const unsigned char *data, int size, bool compress)
+{
+    item.entry.rawSize = size;
+    if (compress)
+    {
+        std::vector<unsigned char> compressed(iLZ4CompressBound(size));
+        int compressedSize = iLZ4Compress(data, size, compressed.data(), (int)compressed.size());
+        if (compressedSize > 0 && compressedSize < size - size / 4)
+        {
+            item.entry.compression = PACK_LZ4;
+            item.entry.size = compressedSize;
+            item.data.assign(compressed.begin(), compressed.begin() + compressedSize);
+            return;
+        }
+    }
+    item.entry.compression = PACK_RAW;
+    item.entry.size = size;
+    item.data.assign(data, data + size);
+}
+
+bool packImage(std::vector<PackItem> &items, const char *path, int resizeTo, bool compress)
+{
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load(true); // Same orientation as iLoadImage2.
+    unsigned char *pixels = stbi_load(path, &width, &height, &channels, 0);
+    if (!pixels)
+    {
+        printf("ERROR: Failed to load image %s: %s\n", path, stbi_failure_reason());
+        return false;
+    }
+
+    if (resizeTo > 0 && (width != resizeTo || height != resizeTo) && (channels == 3 || channels == 4))
+    {
+        // Same filter as the game (RESIZE_PIXEL_ART), so the result matches what it would compute at runtime.
+        unsigned char *resized = (unsigned char *)malloc(resizeTo * resizeTo * channels);
+        iResizePixelsNearest(pixels, width, height, resized, resizeTo, resizeTo, channels);
+        stbi_image_free(pixels);
+        pixels = resized;
+        width = height = resizeTo;
+    }
+
+    PackItem item = {};
+    iNormalizePackName(item.entry.name, path);
+    item.entry.type = PACK_IMAGE;
+    item.entry.width = width;
+    item.entry.height = height;
+    item.entry.channels = channels;
+    storeData(item, pixels, width * height * channels, compress);
+    stbi_image_free(pixels);
+    items.push_back(item);
+    return true;
+}
+
+bool packBlob(std::vector<PackItem> &items, const char *path)
+{
+    PackItem item = {};
+    std::vector<unsigned char> data;
+    if (!readFile(path, data))
+    {
+        printf("ERROR: Failed to read %s\n", path);
+        return false;
+    }
+    iNormalizePackName(item.entry.name, path);
+    item.entry.type = PACK_BLOB;
+    storeData(item, data.data(), (int)data.size(), false); // Blobs are used in place, never compressed.
+    items.push_back(item);
+    return true;
+}
+
+// Packs every PNG (and TTF) in `folder` and its subfolders.
+bool packFolder(std::vector<PackItem> &items, const char *folder, int resizeTo, bool compress)
+{
+    DIR *dir = opendir(folder);
+    if (!dir)
+    {
+        printf("ERROR: Failed to open directory: %s\n", folder);
+        return false;
+    }
+
+    std::vector<std::string> names;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+
+    bool ok = true;
+    for (const std::string &name : names)
+    {
+        std::string path = std::string(folder) + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+            ok = packFolder(items, path.c_str(), resizeTo, compress) && ok;
+        else if (hasExtension(name.c_str(), ".png"))
+            ok = packImage(items, path.c_str(), resizeTo, compress) && ok;
+        else if (hasExtension(name.c_str(), ".ttf"))
+            ok = packBlob(items, path.c_str()) && ok;
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *outputPath = "assets/assets.pack";
+    bool compress = true;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--raw") == 0)
+            compress = false;
+        else
+            outputPath = argv[i];
+    }
+
+    std::vector<PackItem> items;
+    bool ok = true;
+    ok = packFolder(items, "assets/tiles", -1, compress) && ok;
+    ok = packFolder(items, "assets/special_tiles", -1, compress) && ok;
+    ok = packFolder(items, "assets/icons", -1, compress) && ok;
+    ok = packFolder(items, "assets/backgrounds", -1, compress) && ok;
+    ok = packFolder(items, "assets/sprites", SPRITE_SIZE, compress) && ok;
+    ok = packFolder(items, "assets/fonts", -1, compress) && ok;
+    if (!ok)
+        return 1;
+
+    std::sort(items.begin(), items.end(), [](const PackItem &a, const PackItem &b)
+              { return strcmp(a.entry.name, b.entry.name) < 0; });
+
+    // Layout: header, index, then the entry data, each aligned to PACK_ALIGNMENT.
+    PackHeader header = {};
+    memcpy(header.magic, PACK_MAGIC, 4);
+    header.version = PACK_VERSION;
+    header.entryCount = (uint32_t)items.size();
+    header.indexOffset = sizeof(PackHeader);
+
+    uint32_t offset = header.indexOffset + header.entryCount * sizeof(PackEntry);
+    for (PackItem &item : items)
+    {
+        offset = (offset + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+        item.entry.offset = offset;
+        offset += item.entry.size;
+    }
+
+    FILE *file = fopen(outputPath, "wb");
+    if (!file)
+    {
+        printf("ERROR: Failed to create %s\n", outputPath);
+        return 1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    for (const PackItem &item : items)
+        fwrite(&item.entry, sizeof(PackEntry), 1, file);
+
+    long rawTotal = 0;
+    for (const PackItem &item : items)
+    {
+        static const unsigned char padding[PACK_ALIGNMENT] = {};
+        fwrite(padding, 1, item.entry.offset - ftell(file), file);
+        fwrite(item.data.data(), 1, item.data.size(), file);
+        rawTotal += item.entry.rawSize;
+    }
+    long packedTotal = ftell(file);
+    fclose(file);
+
+    printf("Packed %d entries into %s: %.1f KB (%.1f KB decoded)\n", (int)items.size(), outputPath,
+           packedTotal / 1024.0, rawTotal / 1024.0);
+    return 0;
+}
@@ -0,0 +1,79 @@
+// Compiles the levels into levels/levelN/level.bin (see levelFormat.h), which the game reads with
+// a single fread. The Tiled maps (level_editor/levelN.tmx) are read with their tileset, the alternative
+// coin, flag and life tiles are remapped, and the collider, collectable and trap masks are computed
+// ahead of time.
+//
+// Build and run from the project root:
+//   g++ -O2 -I. helpers/level_compiler.cpp -o bin/level_compiler
+//   ./bin/level_compiler [level numbers, default every level]
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "levelFormat.h"
+
+bool writeLevelFile(int level, LevelFile *file)
+{
+    char path[MAX_TMX_PATH_LEN];
+    sprintf(path, "levels/level%d", level);
+#ifdef _WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+
+    sprintf(path, LEVEL_FILE_PATH, level);
+    FILE *levelFile = fopen(path, "wb");
+    if (!levelFile)
+    {
+        printf("ERROR: Failed to create %s\n", path);
+        return false;
+    }
+    size_t size = levelFileSize(&file->header);
+    bool ok = fwrite(file, 1, size, levelFile) == size;
+    fclose(levelFile);
+    if (ok)
+        printf("Level %d compiled into %s: %d layers, %d bytes\n", level, path, file->header.layerCount, (int)size);
+    return ok;
+}
+
+bool compileAndWriteLevel(int level)
+{
+    static LevelFile file;
+    if (!compileLevel(level, &file))
+    {
+        printf("ERROR: Failed to compile level %d\n", level);
+        return false;
+    }
+    return writeLevelFile(level, &file);
+}
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+            ok = compileAndWriteLevel(atoi(argv[i])) && ok;
+        return ok ? 0 : 1;
+    }
+
+    // Every level up to the first one without a map.
+    int level = 1;
+    for (;; level++)
+    {
+        char path[MAX_TMX_PATH_LEN];
+        sprintf(path, LEVEL_MAP_PATH, level);
+        struct stat mapStat;
+        if (stat(path, &mapStat) != 0)
+            break;
+        ok = compileAndWriteLevel(level) && ok;
+    }
+    if (level == 1)
+    {
+        printf("ERROR: No levels found, run from the project root\n");
+        return 1;
+    }
+    return ok ? 0 : 1;
+}
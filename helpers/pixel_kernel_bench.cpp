@@ -0,0 +1,219 @@
+// Checks that every pixel kernel set of iPixels.h that this CPU supports gives the same output as the
+// scalar kernels, on random rows of every width up to a few hundred pixels, and times them on a
+// 1024x1024 image. Exits with status 1 if any output differs.
+//
+// Build and run from the project root:
+//   g++ -O2 -I. helpers/pixel_kernel_bench.cpp -o bin/pixel_kernel_bench
+//   ./bin/pixel_kernel_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "iPixels.h"
+
+#define MAX_CHECKED_WIDTH 300
+#define MAX_CHECKED_FACTOR 9
+#define BENCH_SIZE 1024
+#define BENCH_ROUNDS 20
+
+static unsigned int randomState = 12345;
+
+static unsigned char randomByte()
+{
+    randomState = randomState * 1103515245 + 12345;
+    return (randomState >> 16) & 0xFF;
+}
+
+// Random pixels, with a quarter of them set to the color key and a quarter fully transparent.
+static void fillRandomRow(unsigned char *row, int width, int channels, unsigned int color)
+{
+    for (int x = 0; x < width; x++)
+    {
+        unsigned char *pixel = row + x * channels;
+        for (int c = 0; c < channels; c++)
+            pixel[c] = randomByte();
+        int kind = randomByte() % 4;
+        if (kind == 0)
+        {
+            pixel[0] = (color >> 16) & 0xFF;
+            pixel[1] = (color >> 8) & 0xFF;
+            pixel[2] = color & 0xFF;
+        }
+        else if (kind == 1 && channels == 4)
+            pixel[3] = 0;
+    }
+}
+
+static bool checkKernels(const PixelKernels *scalar, const PixelKernels *kernels)
+{
+    static unsigned char row[MAX_CHECKED_WIDTH * 4];
+    static unsigned char expected[MAX_CHECKED_WIDTH * 4 * MAX_CHECKED_FACTOR + 64];
+    static unsigned char actual[MAX_CHECKED_WIDTH * 4 * MAX_CHECKED_FACTOR + 64];
+    const unsigned int color = 0xFF00FF;
+    bool ok = true;
+
+    for (int width = 1; width <= MAX_CHECKED_WIDTH; width++)
+    {
+        for (int channels = 3; channels <= 4; channels++)
+        {
+            int size = width * channels;
+            fillRandomRow(row, width, channels, color);
+
+            memset(expected, 0xAA, sizeof(expected));
+            memset(actual, 0xAA, sizeof(actual));
+            memcpy(expected, row, size);
+            memcpy(actual, row, size);
+            (channels == 4 ? scalar->mirrorRowRGBA : scalar->mirrorRowRGB)(expected, width);
+            (channels == 4 ? kernels->mirrorRowRGBA : kernels->mirrorRowRGB)(actual, width);
+            if (memcmp(expected, actual, sizeof(expected)) != 0)
+            {
+                printf("%s: mirrorRow differs for %d channels, width %d\n", kernels->name, channels, width);
+                ok = false;
+            }
+
+            memcpy(expected, row, size);
+            memcpy(actual, row, size);
+            (channels == 4 ? scalar->colorKeyRGBA : scalar->colorKeyRGB)(expected, width, color);
+            (channels == 4 ? kernels->colorKeyRGBA : kernels->colorKeyRGB)(actual, width, color);
+            if (memcmp(expected, actual, size) != 0)
+            {
+                printf("%s: colorKey differs for %d channels, width %d\n", kernels->name, channels, width);
+                ok = false;
+            }
+
+            for (int factor = 1; factor <= MAX_CHECKED_FACTOR; factor++)
+            {
+                memset(expected, 0xAA, sizeof(expected));
+                memset(actual, 0xAA, sizeof(actual));
+                (channels == 4 ? scalar->scaleRowRGBA : scalar->scaleRowRGB)(row, width, expected, factor);
+                (channels == 4 ? kernels->scaleRowRGBA : kernels->scaleRowRGB)(row, width, actual, factor);
+                if (memcmp(expected, actual, sizeof(expected)) != 0)
+                {
+                    printf("%s: scaleRow differs for %d channels, width %d, factor %d\n", kernels->name, channels, width, factor);
+                    ok = false;
+                }
+            }
+        }
+
+        uint64_t expectedMask[MAX_CHECKED_WIDTH / 64 + 1], actualMask[MAX_CHECKED_WIDTH / 64 + 1];
+        memset(actualMask, 0xAA, sizeof(actualMask)); // Every word must be written.
+        scalar->alphaMaskRGBA(row, width, expectedMask);
+        kernels->alphaMaskRGBA(row, width, actualMask);
+        if (memcmp(expectedMask, actualMask, sizeof(uint64_t) * ((width + 63) / 64)) != 0)
+        {
+            printf("%s: alphaMask differs for width %d\n", kernels->name, width);
+            ok = false;
+        }
+    }
+
+    // Mask rows of 3 to 12 words, ANDed from every pair of starts over the rest of the rows.
+    uint64_t maskA[12], maskB[12];
+    for (int words = 3; words <= 12; words++)
+    {
+        for (int i = 0; i < words; i++)
+        {
+            maskA[i] = maskB[i] = 0;
+            for (int j = 0; j < 8; j++)
+            {
+                maskA[i] = maskA[i] << 8 | randomByte();
+                maskB[i] = maskB[i] << 8 | (randomByte() & randomByte()); // Sparser
+            }
+        }
+        int width = words * 64 - randomByte() % 64;
+        for (int startA = 0; startA < width; startA += 1 + randomByte() % 7)
+        {
+            for (int startB = 0; startB < width; startB += 1 + randomByte() % 23)
+            {
+                int count = width - (startA > startB ? startA : startB);
+                for (int isAnyEnough = 0; isAnyEnough <= 1; isAnyEnough++)
+                {
+                    if (scalar->andMaskBits(maskA, startA, maskB, startB, count, isAnyEnough) !=
+                        kernels->andMaskBits(maskA, startA, maskB, startB, count, isAnyEnough))
+                    {
+                        printf("%s: andMaskBits differs for starts %d and %d, count %d\n", kernels->name, startA, startB, count);
+                        ok = false;
+                    }
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+static double nowMs()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Milliseconds per 1024x1024 RGBA image, for each kernel.
+static void benchKernels(const PixelKernels *kernels, unsigned char *image, unsigned char *output)
+{
+    uint64_t mask[BENCH_SIZE / 64];
+    double start = nowMs();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+        for (int y = 0; y < BENCH_SIZE; y++)
+            kernels->mirrorRowRGBA(image + y * BENCH_SIZE * 4, BENCH_SIZE);
+    double mirrorMs = (nowMs() - start) / BENCH_ROUNDS;
+
+    memcpy(output, image, BENCH_SIZE * BENCH_SIZE * 4);
+    start = nowMs();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+        kernels->colorKeyRGBA(output, BENCH_SIZE * BENCH_SIZE, 0xFF00FF);
+    double colorKeyMs = (nowMs() - start) / BENCH_ROUNDS;
+
+    start = nowMs();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+        for (int y = 0; y < BENCH_SIZE; y++)
+            kernels->alphaMaskRGBA(image + y * BENCH_SIZE * 4, BENCH_SIZE, mask);
+    double alphaMaskMs = (nowMs() - start) / BENCH_ROUNDS;
+
+    // Upscaling a 256x256 quarter of the image by 2, 3 and 4, each to at most a 1024x1024 image.
+    double scaleMs[3];
+    for (int factor = 2; factor <= 4; factor++)
+    {
+        start = nowMs();
+        for (int round = 0; round < BENCH_ROUNDS; round++)
+            for (int y = 0; y < BENCH_SIZE / 4 * factor; y++)
+                kernels->scaleRowRGBA(image + y / factor * BENCH_SIZE * 4, BENCH_SIZE / 4, output + y * BENCH_SIZE * 4, factor);
+        scaleMs[factor - 2] = (nowMs() - start) / BENCH_ROUNDS;
+    }
+
+    // Overlap of two 1024x1024 masks, offset by 3 pixels.
+    static uint64_t masks[2][BENCH_SIZE][BENCH_SIZE / 64];
+    for (int y = 0; y < BENCH_SIZE; y++)
+    {
+        kernels->alphaMaskRGBA(image + y * BENCH_SIZE * 4, BENCH_SIZE, masks[0][y]);
+        kernels->alphaMaskRGBA(image + (BENCH_SIZE - 1 - y) * BENCH_SIZE * 4, BENCH_SIZE, masks[1][y]);
+    }
+    int overlap = 0;
+    start = nowMs();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+        for (int y = 0; y < BENCH_SIZE; y++)
+            overlap += kernels->andMaskBits(masks[0][y], 3, masks[1][y], 0, BENCH_SIZE - 3, false);
+    double andMaskMs = (nowMs() - start) / BENCH_ROUNDS;
+
+    printf("%-8s mirrorRow %7.3f ms  colorKey %7.3f ms  alphaMask %7.3f ms  scaleRow x2/x3/x4 %.3f/%.3f/%.3f ms  andMask %7.3f ms (%d)\n",
+           kernels->name, mirrorMs, colorKeyMs, alphaMaskMs, scaleMs[0], scaleMs[1], scaleMs[2], andMaskMs, overlap / BENCH_ROUNDS);
+}
+
+int main()
+{
+    int bestLevel = iDetectPixelKernelLevel();
+    printf("Pixel kernels used by the game: %s\n", iPixelKernelSets[bestLevel].name);
+
+    bool ok = true;
+    for (int level = PIXEL_KERNELS_SCALAR + 1; level <= bestLevel; level++)
+        ok = checkKernels(&iPixelKernelSets[PIXEL_KERNELS_SCALAR], &iPixelKernelSets[level]) && ok;
+    printf(ok ? "Every kernel matches the scalar kernels\n" : "ERROR: Some kernels differ from the scalar kernels\n");
+
+    unsigned char *image = (unsigned char *)malloc(BENCH_SIZE * BENCH_SIZE * 4);
+    unsigned char *output = (unsigned char *)malloc(BENCH_SIZE * BENCH_SIZE * 4);
+    for (int y = 0; y < BENCH_SIZE; y++)
+        fillRandomRow(image + y * BENCH_SIZE * 4, BENCH_SIZE, 4, 0xFF00FF);
+    for (int level = PIXEL_KERNELS_SCALAR; level <= bestLevel; level++)
+        benchKernels(&iPixelKernelSets[level], image, output);
+    free(image);
+    free(output);
+    return ok ? 0 : 1;
+}
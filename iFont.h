@@ -1,5 +1,5 @@
 /***
- * iFont.h: v0.1.2
+ * iFont.h: v0.1.3
  * A simple font rendering system using FreeType and OpenGL.
  * Provides functions to initialize the font system, render text at specified positions,
  * and free resources.
@@ -13,6 +13,9 @@
  */
 
 #include "glut.h"
+#include "iProfiler.h"
+#include "iPack.h"
+#include "iResource.h"
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
@@ -37,6 +40,32 @@ bool iInitializeFont()
     return true;
 }
 
+// Fonts are cached by the resource manager (see iResource.h), so a face is opened once, not on every iShowText.
+bool iLoadFontResource(Resource *r, const char *fontPath, int, int, int)
+{
+    if (!g_ftInitialized)
+        return false;
+    FT_Face face;
+    // Fonts in the asset pack are stored raw, so FreeType can read them straight from the mapping.
+    const PackEntry *packedFont = iFindPackEntry(fontPath);
+    FT_Error error = packedFont ? FT_New_Memory_Face(g_ftLibrary, iPackEntryData(packedFont), packedFont->size, 0, &face)
+                                : FT_New_Face(g_ftLibrary, fontPath, 0, &face);
+    if (error)
+        return false;
+    FT_Select_Charmap(face, FT_ENCODING_UNICODE);
+    r->data = face;
+    r->count = 1;
+    r->cpuBytes = packedFont ? 0 : face->stream->size;
+    return true;
+}
+
+void iUnloadFontResource(Resource *r)
+{
+    FT_Done_Face((FT_Face)r->data);
+}
+
+int iFontResourceType = iRegisterResourceType("font", iLoadFontResource, iUnloadFontResource);
+
 // Freetype: https://gnuwin32.sourceforge.net/packages/freetype.htm
 // Draw text at position (x, y) using font file `fontName`
 
@@ -79,6 +108,161 @@ uint32_t getNextUTF8Codepoint(const char *&p)
     return codepoint;
 }
 
+// * Glyph atlases
+// Rendered glyphs are kept in one alpha texture per font and size, added the first time they are drawn. Drawing
+// text then binds a single texture and creates none, where it used to create and delete one per glyph.
+#define MAX_GLYPH_ATLASES 16
+#define MAX_ATLAS_GLYPHS 256
+#define MAX_FONT_PATH_LEN 128
+#define GLYPH_PADDING 1 // Empty pixels around each glyph, so that linear filtering does not pick up its neighbors
+
+typedef struct
+{
+    uint32_t codepoint;
+    float u1, v1, u2, v2; // Texture coordinates of the bottom-left and top-right corners
+    int width, height;
+    float left, bottom; // Offset of the bottom-left corner from the pen position
+    int advance;        // In pixels
+} AtlasGlyph;
+
+typedef struct
+{
+    char fontPath[MAX_FONT_PATH_LEN];
+    int fontSize;
+    GLuint textureId;
+    int size;                        // Width and height of the texture
+    int shelfX, shelfY, shelfHeight; // Where the next glyph goes, see iAddAtlasGlyph
+    AtlasGlyph glyphs[MAX_ATLAS_GLYPHS];
+    int glyphCount;
+} GlyphAtlas;
+
+GlyphAtlas iGlyphAtlases[MAX_GLYPH_ATLASES];
+int iGlyphAtlasCount = 0;
+
+// The atlas of a font and size, created on first use. nullptr if there are already MAX_GLYPH_ATLASES.
+static GlyphAtlas *iGetGlyphAtlas(const char *fontPath, int fontSize)
+{
+    for (int i = 0; i < iGlyphAtlasCount; i++)
+    {
+        if (iGlyphAtlases[i].fontSize == fontSize && strcmp(iGlyphAtlases[i].fontPath, fontPath) == 0)
+            return &iGlyphAtlases[i];
+    }
+    if (iGlyphAtlasCount >= MAX_GLYPH_ATLASES || strlen(fontPath) >= MAX_FONT_PATH_LEN)
+        return nullptr;
+
+    GlyphAtlas *atlas = &iGlyphAtlases[iGlyphAtlasCount++];
+    snprintf(atlas->fontPath, MAX_FONT_PATH_LEN, "%s", fontPath);
+    atlas->fontSize = fontSize;
+    atlas->size = fontSize <= 48 ? 512 : 1024;
+    atlas->shelfX = atlas->shelfY = atlas->shelfHeight = 0;
+    atlas->glyphCount = 0;
+
+    // Cleared, so that the padding around the glyphs is empty.
+    unsigned char *pixels = (unsigned char *)calloc((size_t)atlas->size * atlas->size, 1);
+    glGenTextures(1, &atlas->textureId);
+    iTrackTextureCreate();
+    glBindTexture(GL_TEXTURE_2D, atlas->textureId);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, atlas->size, atlas->size, 0, GL_ALPHA, GL_UNSIGNED_BYTE, pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    free(pixels);
+    return atlas;
+}
+
+static const AtlasGlyph *iFindAtlasGlyph(const GlyphAtlas *atlas, uint32_t codepoint)
+{
+    for (int i = 0; i < atlas->glyphCount; i++)
+    {
+        if (atlas->glyphs[i].codepoint == codepoint)
+            return &atlas->glyphs[i];
+    }
+    return nullptr;
+}
+
+// Renders a glyph with `face` (already set to the size of the atlas) into the atlas, on shelves from the top
+// left. Returns nullptr if the glyph cannot be rendered or the atlas is full.
+static const AtlasGlyph *iAddAtlasGlyph(GlyphAtlas *atlas, FT_Face face, uint32_t codepoint)
+{
+    if (atlas->glyphCount >= MAX_ATLAS_GLYPHS)
+        return nullptr;
+    if (FT_Load_Glyph(face, FT_Get_Char_Index(face, codepoint), FT_LOAD_RENDER))
+        return nullptr;
+    FT_GlyphSlot g = face->glyph;
+    int width = g->bitmap.width, height = g->bitmap.rows;
+    int paddedWidth = width + 2 * GLYPH_PADDING, paddedHeight = height + 2 * GLYPH_PADDING;
+    if (atlas->shelfX + paddedWidth > atlas->size)
+    {
+        atlas->shelfX = 0;
+        atlas->shelfY += atlas->shelfHeight;
+        atlas->shelfHeight = 0;
+    }
+    if (paddedWidth > atlas->size || atlas->shelfY + paddedHeight > atlas->size)
+        return nullptr;
+
+    int x = atlas->shelfX + GLYPH_PADDING, y = atlas->shelfY + GLYPH_PADDING;
+    if (width > 0 && height > 0)
+    {
+        glBindTexture(GL_TEXTURE_2D, atlas->textureId);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, g->bitmap.pitch);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_ALPHA, GL_UNSIGNED_BYTE, g->bitmap.buffer);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    atlas->shelfX += paddedWidth;
+    atlas->shelfHeight = paddedHeight > atlas->shelfHeight ? paddedHeight : atlas->shelfHeight;
+
+    // The bitmap rows are stored from the top down, so the bottom of the glyph is at the larger v.
+    AtlasGlyph *glyph = &atlas->glyphs[atlas->glyphCount++];
+    glyph->codepoint = codepoint;
+    glyph->u1 = (float)x / atlas->size;
+    glyph->v1 = (float)(y + height) / atlas->size;
+    glyph->u2 = (float)(x + width) / atlas->size;
+    glyph->v2 = (float)y / atlas->size;
+    glyph->width = width;
+    glyph->height = height;
+    glyph->left = g->bitmap_left;
+    glyph->bottom = g->bitmap_top - g->metrics.height / 64.0f;
+    glyph->advance = g->advance.x >> 6;
+    return glyph;
+}
+
+// Draws a glyph that does not fit into its atlas with a texture of its own, as every glyph used to be drawn.
+// Returns its advance in pixels, or 0 if it cannot be rendered.
+static int iShowUncachedGlyph(FT_Face face, uint32_t codepoint, float x, float y)
+{
+    if (FT_Load_Glyph(face, FT_Get_Char_Index(face, codepoint), FT_LOAD_RENDER))
+        return 0;
+    FT_GlyphSlot g = face->glyph;
+    GLuint tex;
+    glGenTextures(1, &tex);
+    iTrackTextureCreate();
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, g->bitmap.width, g->bitmap.rows, 0, GL_ALPHA, GL_UNSIGNED_BYTE, g->bitmap.buffer);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    float xpos = x + g->bitmap_left;
+    float ypos = y - (g->metrics.height / 64.0 - g->bitmap_top);
+    float w = g->bitmap.width;
+    float h = g->bitmap.rows;
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 1);
+    glVertex2f(xpos, ypos);
+    glTexCoord2f(1, 1);
+    glVertex2f(xpos + w, ypos);
+    glTexCoord2f(1, 0);
+    glVertex2f(xpos + w, ypos + h);
+    glTexCoord2f(0, 0);
+    glVertex2f(xpos, ypos + h);
+    glEnd();
+
+    glDeleteTextures(1, &tex);
+    iTrackTextureDelete();
+    return g->advance.x >> 6;
+}
+
 void iShowText(double x, double y, const char *text, const char *fontPath, int fontSize = 48)
 {
     if (!g_ftInitialized)
@@ -87,17 +271,19 @@ void iShowText(double x, double y, const char *text, const char *fontPath, int f
         return;
     }
 
-    if (FT_New_Face(g_ftLibrary, fontPath, 0, &g_ftFace))
+    int profile = iProfileBegin("text", "iShowText");
+    int font = iAcquireResource(iFontResourceType, fontPath);
+    if (font < 0)
     {
         printf("Failed to load font: %s\n", fontPath);
+        iProfileEnd(profile);
         return;
     }
-
-    FT_Select_Charmap(g_ftFace, FT_ENCODING_UNICODE);
-    FT_Set_Pixel_Sizes(g_ftFace, 0, fontSize);
+    g_ftFace = (FT_Face)iResourceData(font);
+    bool isSizeSet = false; // Only glyphs that are not in the atlas yet are rendered.
+    GlyphAtlas *atlas = iGetGlyphAtlas(fontPath, fontSize);
 
     glEnable(GL_TEXTURE_2D);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
     float originX = x;
     const char *p = text;
@@ -105,58 +291,56 @@ void iShowText(double x, double y, const char *text, const char *fontPath, int f
     while (*p)
     {
         uint32_t codepoint = getNextUTF8Codepoint(p);
-        FT_UInt glyph_index = FT_Get_Char_Index(g_ftFace, codepoint);
-
-        if (FT_Load_Glyph(g_ftFace, glyph_index, FT_LOAD_RENDER))
+        const AtlasGlyph *glyph = atlas ? iFindAtlasGlyph(atlas, codepoint) : nullptr;
+        if (!glyph && !isSizeSet)
+        {
+            FT_Set_Pixel_Sizes(g_ftFace, 0, fontSize);
+            isSizeSet = true;
+        }
+        if (!glyph && atlas)
+            glyph = iAddAtlasGlyph(atlas, g_ftFace, codepoint);
+        if (!glyph)
+        {
+            originX += iShowUncachedGlyph(g_ftFace, codepoint, originX, y);
             continue;
+        }
 
-        FT_GlyphSlot g = g_ftFace->glyph;
-
-        GLuint tex;
-        glGenTextures(1, &tex);
-        glBindTexture(GL_TEXTURE_2D, tex);
-        glTexImage2D(
-            GL_TEXTURE_2D,
-            0,
-            GL_ALPHA,
-            g->bitmap.width,
-            g->bitmap.rows,
-            0,
-            GL_ALPHA,
-            GL_UNSIGNED_BYTE,
-            g->bitmap.buffer);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        float xpos = originX + g->bitmap_left;
-        float ypos = y - (g->metrics.height / 64.0 - g->bitmap_top);
-        float w = g->bitmap.width;
-        float h = g->bitmap.rows;
+        float xpos = originX + glyph->left;
+        float ypos = y + glyph->bottom;
+        float w = glyph->width;
+        float h = glyph->height;
 
+        glBindTexture(GL_TEXTURE_2D, atlas->textureId);
         glBegin(GL_QUADS);
-        glTexCoord2f(0, 1);
+        glTexCoord2f(glyph->u1, glyph->v1);
         glVertex2f(xpos, ypos);
-        glTexCoord2f(1, 1);
+        glTexCoord2f(glyph->u2, glyph->v1);
         glVertex2f(xpos + w, ypos);
-        glTexCoord2f(1, 0);
+        glTexCoord2f(glyph->u2, glyph->v2);
         glVertex2f(xpos + w, ypos + h);
-        glTexCoord2f(0, 0);
+        glTexCoord2f(glyph->u1, glyph->v2);
         glVertex2f(xpos, ypos + h);
         glEnd();
 
-        originX += (g->advance.x >> 6);
-        glDeleteTextures(1, &tex);
+        originX += glyph->advance;
     }
 
     glDisable(GL_TEXTURE_2D);
-    FT_Done_Face(g_ftFace);
+    iReleaseResource(font);
+    iProfileEnd(profile);
 }
 
 void iFreeFont()
 {
     if (g_ftInitialized)
     {
+        for (int i = 0; i < iGlyphAtlasCount; i++)
+        {
+            glDeleteTextures(1, &iGlyphAtlases[i].textureId);
+            iTrackTextureDelete();
+        }
+        iGlyphAtlasCount = 0;
+        iFreeUnusedResources(iFontResourceType);
         FT_Done_FreeType(g_ftLibrary);
         g_ftInitialized = false;
     }
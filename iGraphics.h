@@ -25,49 +25,111 @@
 #include <stdlib.h>
 #ifdef _WIN32
 #include <windows.h>
+#include <direct.h>
 #else
 // Include POSIX or Linux-specific headers if needed
 #include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
 #endif
 
 #include "freeglut.h"
+#include "iProfiler.h"
+#include "iPack.h"
+#include "iResource.h"
+#include "iPixels.h"
 #include <time.h>
 #include <math.h>
 #include <dirent.h>
 #include <sys/stat.h>
 // #include "glaux.h"
+// Route the heap usage of the bundled libraries through the allocation tracker of iProfiler.h.
+#define STBI_MALLOC(sz) iTrackedMalloc(sz)
+#define STBI_REALLOC(p, newsz) iTrackedRealloc(p, newsz)
+#define STBI_FREE(p) iTrackedFree(p)
+#define STBIR_MALLOC(size, user_data) ((void)(user_data), iTrackedMalloc(size))
+#define STBIR_FREE(ptr, user_data) ((void)(user_data), iTrackedFree(ptr))
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STBIRDEF extern
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include "stb_image_resize2.h"
 
+#define malloc iTrackedMalloc
+#define realloc iTrackedRealloc
+#define free iTrackedFree
 #define NANOSVG_IMPLEMENTATION
 #include "nanosvg.h"
 #define NANOSVGRAST_IMPLEMENTATION
 #include "nanosvgrast.h"
+#undef malloc
+#undef realloc
+#undef free
 
 static int transparent = 1;
 static int isFullScreen = 0;
 static int isGameMode = 0;
 static int programEnded = 0;
+static int windowCreated = 0; // Textures can only be created once the window (and its GL context) exists.
 const char *iWindowTitle = nullptr;
+static bool gpuResidentImages = false; // See iSetGpuResidentImages
+
+enum MirrorState
+{
+    NO_MIRROR,
+    HORIZONTAL,
+    VERTICAL,
+    MIRROR_BOTH // HORIZONTAL | VERTICAL
+};
+
+// Who owns the pixels of an image, i.e. how iFreeImageData frees them.
+enum PixelOwner
+{
+    PIXELS_MALLOC, // iTrackedMalloc, which stb_image uses too
+    PIXELS_POOLED, // iAllocPixels, see "Pixel buffer pool"
+    PIXELS_MAPPED  // Points into the mapped asset pack, never freed
+};
+
 typedef struct
 {
-    unsigned char *data;
+    unsigned char *data; // nullptr once a GPU-resident image is uploaded
     int width, height, channels;
     GLuint textureId; // OpenGL texture ID
     // image type svg and non-svg
-    bool isSVG; // true if the image is SVG, false if it's a raster image
+    bool isSVG;        // true if the image is SVG, false if it's a raster image
+    PixelOwner dataOwner;
+    // GPU-resident images only
+    uint64_t *alphaMask; // 1 bit per pixel, set if the pixel is not transparent. nullptr for images without alpha.
+    MirrorState mirror;  // Applied with the texture coordinates, as there are no pixels to mirror
 } Image;
 
+typedef struct
+{
+    int x, y, width, height; // In the pixels of the atlas
+    float u1, v1, u2, v2;    // Texture coordinates of the bottom-left and top-right corners
+    // 1-bit mask rows (see iMaskBits), bits set where the frame is not transparent. From the bottom row up.
+    uint64_t *collisionMask;
+    uint64_t *mirroredCollisionMask; // Of the frame flipped horizontally
+    uint64_t *occupancyMask;         // Coarser levels of collisionMask, see "Occupancy masks"
+} FrameRect;
+
+// Animation frames packed into one image, so a whole animation is one texture. See "Frame sets".
+typedef struct
+{
+    Image atlas;
+    FrameRect *frames;
+    int frameCount;
+    int refCount;               // See iRetainFrameSet
+    uint64_t *maskWords;       // The collision masks of every frame
+} FrameSet;
+
 typedef struct
 {
     int x, y;
-    Image *frames; // Array of individual frame images
+    FrameSet *frameSet; // May be shared with other sprites, see iSetSpriteFrameSet
     int currentFrame;
     int totalFrames;
-    unsigned char *collisionMask;
+    const uint64_t *collisionMask; // Of the current frame, flipped horizontally like the sprite. Owned by the frame set.
     // int ignoreColor;
 
     // Tracking transformation
@@ -77,14 +139,6 @@ typedef struct
     float rotationCenterX, rotationCenterY; // Center of rotation relative to the sprite's top-left corner
 } Sprite;
 
-enum MirrorState
-{
-    NO_MIRROR,
-    HORIZONTAL,
-    VERTICAL,
-    MIRROR_BOTH
-};
-
 int iScreenHeight, iScreenWidth;
 int iSmallScreenHeight, iSmallScreenWidth;
 
@@ -134,7 +188,9 @@ void timerCallback(int index)
         // int currentTime = glutGet(GLUT_ELAPSED_TIME);             // milliseconds since start
         // int deltaTime = (currentTime - iAnimLastCallTime[index]); // in seconds
         // iAnimLastCallTime[index] = currentTime;
+        int profile = iProfileBegin("timer", "timer");
         iAnimFunction[index]();
+        iProfileEnd(profile);
     }
 
     glutTimerFunc(iAnimDelays[index], timerCallback, index);
@@ -173,12 +229,59 @@ void iResumeTimer(int index)
     }
 }
 
+unsigned char *iAllocPixels(size_t size); // See "Pixel buffer pool"
+void iFreePixels(unsigned char *pixels);
+
+// Frees the pixel buffer of an image with the deallocator of its owner.
+void iFreeImageData(Image *img)
+{
+    if (img->dataOwner == PIXELS_MALLOC)
+        stbi_image_free(img->data);
+    else if (img->dataOwner == PIXELS_POOLED)
+        iFreePixels(img->data);
+    img->data = nullptr;
+    img->dataOwner = PIXELS_MALLOC;
+}
+
+// Replaces pixels that point into the mapped asset pack with a copy, before they are changed in place.
+// Other images loaded from the same pack entry share the mapped pixels.
+static void iOwnImageData(Image *img)
+{
+    if (img->dataOwner != PIXELS_MAPPED)
+        return;
+    size_t size = (size_t)img->width * img->height * img->channels;
+    unsigned char *pixels = iAllocPixels(size);
+    memcpy(pixels, img->data, size);
+    img->data = pixels;
+    img->dataOwner = PIXELS_POOLED;
+}
+
+// * Texture warm-up
+// A texture is created the first time its image is drawn, which stalls that frame. iWarmTextures uploads
+// images ahead of time instead, e.g. right after they are loaded. Frames marked with iSetSteadyFrame should
+// not upload anything, and debug builds report every upload that happens in one.
+static bool iIsSteadyFrame = false;
+
+void iSetSteadyFrame(bool isSteady)
+{
+    iIsSteadyFrame = isSteady;
+}
+
+static void iCheckTextureUpload(const Image *img)
+{
+#ifndef NDEBUG
+    if (iIsSteadyFrame)
+        printf("ASSERTION FAILED: %dx%d texture uploaded during a steady-state frame, it should be warmed up (see iWarmTextures)\n", img->width, img->height);
+#endif
+}
+
 void iUpdateTexture(Image *img, bool resized = false)
 {
     if (!img->textureId)
     {
         return; // No texture to update
     }
+    iCheckTextureUpload(img);
     glBindTexture(GL_TEXTURE_2D, img->textureId);
     GLenum format = (img->channels == 4) ? GL_RGBA : GL_RGB;
 
@@ -196,37 +299,108 @@ void iUpdateTexture(Image *img, bool resized = false)
     }
 }
 
-void iIgnorePixels(Image *img, int ignoreColor = -1)
+// * GPU-resident images
+// Opt-in. Once an image is uploaded to the GPU, its pixels are freed and only a 1-bit alpha mask is kept
+// for the pixel collision functions. Mirroring only flips the texture coordinates. The other functions that
+// transform pixels read them back from the texture first (see iRestoreImageData).
+void iSetGpuResidentImages(bool enabled)
 {
-    if (ignoreColor == -1 || img->data == nullptr)
-        return;
+    gpuResidentImages = enabled;
+}
+
+// True if the image has pixels or a texture, i.e. it was loaded and not freed since.
+bool iIsImageLoaded(const Image *img)
+{
+    return img->data != nullptr || img->textureId != 0;
+}
 
-    unsigned char ignoreR = (ignoreColor >> 16) & 0xFF;
-    unsigned char ignoreG = (ignoreColor >> 8) & 0xFF;
-    unsigned char ignoreB = ignoreColor & 0xFF;
+static int iAlphaMaskStride(const Image *img) // in 64-bit words
+{
+    return (img->width + 63) / 64;
+}
 
-    for (int i = 0; i < img->width * img->height * img->channels; i += img->channels)
+// Frees the pixels of an uploaded image, keeping its alpha mask.
+void iReleaseImageData(Image *img)
+{
+    if (!img->data || !img->textureId)
+        return;
+    if (img->channels == 4 && !img->alphaMask)
     {
-        if (img->data[i] == ignoreR && img->data[i + 1] == ignoreG && img->data[i + 2] == ignoreB)
-        {
-            if (img->channels == 4)
-            {
-                img->data[i + 3] = 0; // Set alpha to 0 for transparency
-            }
-            else
-            {
-                img->data[i] = img->data[i + 1] = img->data[i + 2] = 0; // Set RGB to black
-            }
-        }
+        int stride = iAlphaMaskStride(img);
+        img->alphaMask = new uint64_t[stride * img->height];
+        for (int y = 0; y < img->height; y++)
+            iPixelKernels.alphaMaskRGBA(img->data + (size_t)y * img->width * 4, img->width, img->alphaMask + y * stride);
     }
+    iFreeImageData(img);
+}
+
+// Reads the pixels of an image back from its texture, as they were uploaded (i.e. without `mirror`).
+static void iReadTexturePixels(const Image *img, unsigned char *pixels)
+{
+    glBindTexture(GL_TEXTURE_2D, img->textureId);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, (img->channels == 4) ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, pixels);
+}
+
+void iMirrorImage(Image *img, MirrorState state);
+
+// Gives a GPU-resident image its pixels back, for the functions that transform them. They are freed again
+// when the image is drawn next. Returns false if the image has neither pixels nor a texture.
+bool iRestoreImageData(Image *img)
+{
+    if (img->data)
+        return true;
+    if (!img->textureId)
+        return false;
+
+    img->data = (unsigned char *)iTrackedMalloc((size_t)img->width * img->height * img->channels);
+    img->dataOwner = PIXELS_MALLOC;
+    iReadTexturePixels(img, img->data);
+    delete[] img->alphaMask;
+    img->alphaMask = nullptr;
+
+    // The pixels (and the texture) are mirrored instead.
+    MirrorState mirror = img->mirror;
+    img->mirror = NO_MIRROR;
+    if (mirror & HORIZONTAL)
+        iMirrorImage(img, HORIZONTAL);
+    if (mirror & VERTICAL)
+        iMirrorImage(img, VERTICAL);
+    return true;
+}
+
+// False if the pixel at (x, y) of the image is fully transparent.
+bool iIsPixelOpaque(const Image *img, int x, int y)
+{
+    if (img->data)
+        return img->channels != 4 || img->data[((size_t)y * img->width + x) * 4 + 3] != 0;
+    if (!img->alphaMask)
+        return true; // No alpha channel
+    if (img->mirror & HORIZONTAL)
+        x = img->width - 1 - x;
+    if (img->mirror & VERTICAL)
+        y = img->height - 1 - y;
+    return (img->alphaMask[y * iAlphaMaskStride(img) + x / 64] >> (x % 64)) & 1;
+}
+
+void iIgnorePixels(Image *img, int ignoreColor = -1)
+{
+    if (ignoreColor == -1 || !iRestoreImageData(img))
+        return;
+    iOwnImageData(img);
+
+    // Transparent for RGBA, black for RGB. The rows are contiguous, so the image is keyed as a single row.
+    iColorKeyPixels(img->data, img->width * img->height, img->channels, (unsigned int)ignoreColor);
 
     iUpdateTexture(img); // Update the OpenGL texture after modifying pixel data
 }
 
 bool iLoadTexture(Image *img)
 {
+    iCheckTextureUpload(img);
     GLuint texId;
     glGenTextures(1, &texId);
+    iTrackTextureCreate();
     glBindTexture(GL_TEXTURE_2D, texId);
 
     // Set texture parameters ONCE
@@ -245,62 +419,89 @@ bool iLoadTexture(Image *img)
     return true;
 }
 
-bool iLoadSVG(Image *img, const char *filepath, double scale = 1.0)
+// Uploads an image now rather than when it is first drawn. Does nothing before the window is created, or
+// if the image is not loaded or already uploaded. Returns true if it uploaded the image.
+bool iWarmTexture(Image *img)
 {
-    // Load SVG
-    NSVGimage *image = nsvgParseFromFile(filepath, "px", 96.0f);
-    if (!image)
-    {
-        fprintf(stderr, "Could not open SVG file: %s\n", filepath);
+    if (!windowCreated || !img || img->textureId != 0 || img->data == nullptr)
         return false;
-    }
+    iLoadTexture(img);
+    if (gpuResidentImages)
+        iReleaseImageData(img);
+    return true;
+}
 
-    int origW = (int)image->width;
-    int origH = (int)image->height;
+// Uploads every loaded image in `images`. Returns the number of textures created.
+int iWarmTextures(Image *images, int count)
+{
+    int warmedCount = 0;
+    for (int i = 0; i < count; i++)
+        warmedCount += iWarmTexture(&images[i]);
+    return warmedCount;
+}
 
-    int outW = (int)(origW * scale);
-    int outH = (int)(origH * scale);
+int iWarmSpriteTextures(Sprite *s)
+{
+    return s->frameSet ? iWarmTexture(&s->frameSet->atlas) : 0;
+}
 
-    // printf("SVG image size: %d x %d, scaled to: %d x %d\n", origW, origH, outW, outH);
+bool iLoadSVG(Image *img, const char *filepath, double scale = 1.0); // See "SVG rasterization"
 
-    img->data = (unsigned char *)malloc(outW * outH * 4);
-    if (!img->data)
-    {
-        fprintf(stderr, "Failed to allocate image buffer\n");
-        nsvgDelete(image);
+// Loads a pre-decoded image from the open asset pack (see iOpenPack). Raw entries are used straight
+// from the mapping, compressed entries are decompressed into a new buffer.
+// Returns false without printing anything if no pack is open or the pack does not contain the image.
+bool iLoadImageFromPack(Image *img, const char *name, int ignoreColor = -1)
+{
+    const PackEntry *entry = iFindPackEntry(name);
+    if (!entry || entry->type != PACK_IMAGE)
         return false;
-    }
 
-    NSVGrasterizer *rast = nsvgCreateRasterizer();
-    if (!rast)
+    if (entry->compression == PACK_LZ4)
     {
-        fprintf(stderr, "Failed to create rasterizer\n");
-        free(img->data);
-        nsvgDelete(image);
-        return false;
+        img->data = (unsigned char *)iTrackedMalloc(entry->rawSize);
+        if (iLZ4Decompress(iPackEntryData(entry), entry->size, img->data, entry->rawSize) != (int)entry->rawSize)
+        {
+            printf("ERROR: Corrupted asset pack entry: %s\n", entry->name);
+            iTrackedFree(img->data);
+            img->data = nullptr;
+            return false;
+        }
+        img->dataOwner = PIXELS_MALLOC;
     }
-
-    nsvgRasterize(rast, image, 0, 0, scale, img->data, outW, outH, outW * 4);
-
-    img->width = outW;
-    img->height = outH;
-    img->channels = 4; // RGBA
-    img->isSVG = true; // Mark as SVG image
+    else
+    {
+        img->data = iPackEntryData(entry);
+        img->dataOwner = PIXELS_MAPPED;
+    }
+    img->width = entry->width;
+    img->height = entry->height;
+    img->channels = entry->channels;
+    img->isSVG = false;
     img->textureId = 0;
+    img->alphaMask = nullptr;
+    img->mirror = NO_MIRROR;
 
-    nsvgDeleteRasterizer(rast);
-    nsvgDelete(image);
-
+    iIgnorePixels(img, ignoreColor);
     return true;
 }
 
 // Additional functions for displaying images
 bool iLoadImage2(Image *img, const char filename[], int ignoreColor = -1)
 {
+    int profile = iProfileBegin("image", filename);
+    img->alphaMask = nullptr;
+    img->mirror = NO_MIRROR;
+
+    if (iLoadImageFromPack(img, filename, ignoreColor))
+    {
+        iProfileEnd(profile);
+        return true;
+    }
+
     // Check if the image is svg based on extension
     const char *ext = strrchr(filename, '.');
 
-    stbi_set_flip_vertically_on_load(true);
+    stbi_set_flip_vertically_on_load_thread(true); // Per thread, as images may be decoded on worker threads.
     if (ext && (strcmp(ext, ".svg") == 0 || strcmp(ext, ".SVG") == 0))
     {
         iLoadSVG(img, filename);
@@ -309,23 +510,26 @@ bool iLoadImage2(Image *img, const char filename[], int ignoreColor = -1)
     {
         img->data = stbi_load(filename, &img->width, &img->height, &img->channels, 0);
         img->isSVG = false; // Mark as non-SVG image
+        img->dataOwner = PIXELS_MALLOC;
     }
 
     if (img->data == nullptr)
     {
         printf("ERROR: Failed to load image: %s\n", stbi_failure_reason());
+        iProfileEnd(profile);
         return false;
     }
 
     // Ignore the pixels with the specified ignore color
+    img->textureId = 0; // Initialize texture ID to 0 (before iIgnorePixels, which updates an existing texture)
     iIgnorePixels(img, ignoreColor);
-    img->textureId = 0; // Initialize texture ID to 0
+    iProfileEnd(profile);
     return true;
 }
 
 bool iLoadImage(Image *img, const char filename[])
 {
-    iLoadImage2(img, filename, -1);
+    return iLoadImage2(img, filename, -1);
 }
 
 void iFreeTexture(Image *img)
@@ -333,13 +537,17 @@ void iFreeTexture(Image *img)
     if (!img || img->textureId == 0)
         return;
     glDeleteTextures(1, &img->textureId);
+    iTrackTextureDelete();
     img->textureId = 0; // Reset texture ID after deletion
 }
 
 void iFreeImage(Image *img)
 {
     iFreeTexture(img);
-    stbi_image_free(img->data);
+    iFreeImageData(img);
+    delete[] img->alphaMask;
+    img->alphaMask = nullptr;
+    img->mirror = NO_MIRROR;
 }
 
 void iLine(double x1, double y1, double x2, double y2)
@@ -380,6 +588,8 @@ void iShowTexture2(int x, int y, Image *img, int width = -1, int height = -1, Mi
             return;
         }
     }
+    if (gpuResidentImages)
+        iReleaseImageData(img);
 
     // iRectangle(x, y, imgWidth, imgHeight); // Uncomment for debugging rectangle bounds
 
@@ -393,6 +603,7 @@ void iShowTexture2(int x, int y, Image *img, int width = -1, int height = -1, Mi
     float tx2 = 1.0f, ty2 = 1.0f;
 
     // Handle mirror states
+    mirror = (MirrorState)(mirror ^ img->mirror);
     if (mirror == HORIZONTAL || mirror == MIRROR_BOTH)
         sswap(tx1, tx2);
     if (mirror == VERTICAL || mirror == MIRROR_BOTH)
@@ -474,6 +685,8 @@ void iShowTexture2(int x, int y, Image *img, int width = -1, int height = -1, Mi
 
 void iShowLoadedImage2(int x, int y, Image *img, int width = -1, int height = -1, MirrorState mirror = NO_MIRROR)
 {
+    if (!img)
+        return; // e.g. iGetImage of a resource that failed to load
     iShowTexture2(x, y, img, width, height, mirror);
 }
 
@@ -482,40 +695,8 @@ void iShowLoadedImage(int x, int y, Image *img)
     iShowLoadedImage2(x, y, img);
 }
 
-void iShowImage2(int x, int y, const char *filename, int ignoreColor = -1)
-{
-    Image img;
-    if (!iLoadImage2(&img, filename, ignoreColor))
-    {
-        printf("ERROR: Failed to load image: %s\n", filename);
-        return;
-    }
-    iShowTexture2(x, y, &img, -1, -1, NO_MIRROR);
-    iFreeImage(&img);
-}
-
-void iShowImage(int x, int y, const char *filename)
-{
-    iShowImage2(x, y, filename);
-}
-
-void iShowSVG2(double x, double y, const char *filepath, double scale = 1.0, MirrorState mirror = NO_MIRROR)
-{
-    // Load SVG
-    Image img;
-    if (!iLoadSVG(&img, filepath, scale))
-    {
-        printf("ERROR: Failed to load svg: %s\n", filepath);
-        return;
-    }
-    iShowTexture2(x, y, &img, img.width, img.height, mirror);
-    iFreeImage(&img);
-}
-
-void iShowSVG(double x, double y, const char *filepath)
-{
-    iShowSVG2(x, y, filepath);
-}
+void iShowImage2(int x, int y, const char *filename, int ignoreColor = -1); // See "Cached images and frame sets"
+void iShowImage(int x, int y, const char *filename);
 
 void iShowLoadedSVG2(double x, double y, Image *img, MirrorState mirror = NO_MIRROR)
 {
@@ -540,288 +721,549 @@ void iShowLoadedSVG(double x, double y, Image *img)
     iShowLoadedSVG2(x, y, img);
 }
 
+// Reverses the order of `count` rows of `rowSize` bytes, in place.
+static void iReverseRows(unsigned char *rows, int count, size_t rowSize)
+{
+    unsigned char swap[1024];
+    for (int top = 0, bottom = count - 1; top < bottom; top++, bottom--)
+    {
+        unsigned char *topRow = rows + top * rowSize;
+        unsigned char *bottomRow = rows + bottom * rowSize;
+        for (size_t offset = 0; offset < rowSize; offset += sizeof(swap))
+        {
+            size_t size = std::min(sizeof(swap), rowSize - offset);
+            memcpy(swap, topRow + offset, size);
+            memcpy(topRow + offset, bottomRow + offset, size);
+            memcpy(bottomRow + offset, swap, size);
+        }
+    }
+}
+
+// To scroll an image every frame, iShowScrolledImage is much cheaper: it does not touch the pixels.
 void iWrapImage(Image *img, int dx = 0, int dy = 0)
 {
     // Circular shift the image horizontally by dx and vertically by dy pixels
+    if (!iRestoreImageData(img))
+        return;
+    iOwnImageData(img);
     int width = img->width;
     int height = img->height;
     int channels = img->channels;
     unsigned char *data = img->data;
-    unsigned char *wrappedData = new unsigned char[width * height * channels];
 
     // Normalize dx to [0, width), dy to [0, height)
     dx = ((dx % width) + width) % width;
     dy = ((dy % height) + height) % height;
 
-    for (int y = 0; y < height; y++)
+    // In place, by three reversals: reversing the whole sequence and then both of its pieces rotates it.
+    size_t rowSize = (size_t)width * channels;
+    if (dx != 0)
     {
-        for (int x = 0; x < width; x++)
+        for (int y = 0; y < height; y++)
         {
-            int srcIndex = (y * width + x) * channels;
-            int wrappedX = (x + dx) % width;
-            int wrappedY = (y + dy) % height;
-            int dstIndex = (wrappedY * width + wrappedX) * channels;
-
-            for (int c = 0; c < channels; c++)
-            {
-                wrappedData[dstIndex + c] = data[srcIndex + c];
-            }
+            unsigned char *row = data + y * rowSize;
+            iMirrorPixelRow(row, width, channels);
+            iMirrorPixelRow(row, dx, channels);
+            iMirrorPixelRow(row + (size_t)dx * channels, width - dx, channels);
         }
     }
-
-    stbi_image_free(data);
-    img->data = wrappedData;
+    if (dy != 0)
+    {
+        iReverseRows(data, height, rowSize);
+        iReverseRows(data, dy, rowSize);
+        iReverseRows(data + dy * rowSize, height - dy, rowSize);
+    }
 
     iUpdateTexture(img);
 }
 
-void iResizeImage(Image *img, int width, int height)
+// * Scrolling images
+// Backgrounds are scrolled on the GPU: their textures repeat, and only the texture coordinates of a single quad
+// move. Unlike iWrapImage, no pixels are moved or uploaded again, however often the offset changes.
+
+// Copies the region (x, y, width, height) of `src`, in its pixels from the bottom-left corner, into a new image.
+// Returns false if the region is not inside `src`.
+bool iCropImage(Image *src, Image *dst, int x, int y, int width, int height)
+{
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > src->width || y + height > src->height)
+    {
+        printf("ERROR: Crop region %dx%d at (%d, %d) is outside the %dx%d image\n", width, height, x, y, src->width, src->height);
+        return false;
+    }
+    if (!iRestoreImageData(src))
+        return false;
+
+    *dst = {};
+    dst->width = width;
+    dst->height = height;
+    dst->channels = src->channels;
+    dst->dataOwner = PIXELS_POOLED;
+    dst->mirror = NO_MIRROR;
+    dst->data = iAllocPixels((size_t)width * height * dst->channels);
+    size_t rowSize = (size_t)width * dst->channels;
+    for (int row = 0; row < height; row++)
+        memcpy(dst->data + row * rowSize, src->data + ((size_t)(y + row) * src->width + x) * src->channels, rowSize);
+    return true;
+}
+
+// Fills the rectangle (x, y, width, height) with the image, repeated in both directions and scrolled by
+// (offsetX, offsetY) of its pixels, i.e. the pixel at (offsetX, offsetY) of the image is drawn at (x, y).
+void iShowScrolledImage(int x, int y, Image *img, int width, int height, double offsetX, double offsetY = 0)
 {
-    int imgWidth = img->width;
-    int imgHeight = img->height;
-    int channels = img->channels;
-    unsigned char *data = img->data;
-    unsigned char *resizedData = new unsigned char[width * height * channels];
-    stbir_pixel_layout layout;
-    if (channels == 3)
-        layout = STBIR_RGB;
-    else if (channels == 4)
-        layout = STBIR_RGBA;
-    else
+    if (!img || !iIsImageLoaded(img) || x + width <= 0 || y + height <= 0 || x >= iScreenWidth || y >= iScreenHeight)
+        return;
+    if (img->textureId == 0 && !iLoadTexture(img))
+        return;
+    if (gpuResidentImages)
+        iReleaseImageData(img);
+
+    // Wrapped first, so that the texture coordinates stay small enough for float precision.
+    float tx1 = (float)(fmod(offsetX, img->width) / img->width), ty1 = (float)(fmod(offsetY, img->height) / img->height);
+    float tx2 = tx1 + (float)width / img->width, ty2 = ty1 + (float)height / img->height;
+    if (img->mirror & HORIZONTAL)
+    {
+        tx1 = 1.0f - tx1;
+        tx2 = 1.0f - tx2;
+    }
+    if (img->mirror & VERTICAL || img->isSVG)
     {
-        // handle error
+        ty1 = 1.0f - ty1;
+        ty2 = 1.0f - ty2;
     }
-    stbir_resize_uint8_srgb(data, imgWidth, imgHeight, 0, resizedData, width, height, 0, layout);
-    // stbir_resize_uint8(data, imgWidth, imgHeight, 0, resizedData, width, height, 0, channels);
-    stbi_image_free(data);
+
+    glBindTexture(GL_TEXTURE_2D, img->textureId);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glEnable(GL_TEXTURE_2D);
+    glBegin(GL_QUADS);
+    glTexCoord2f(tx1, ty1);
+    glVertex2i(x, y);
+    glTexCoord2f(tx2, ty1);
+    glVertex2i(x + width, y);
+    glTexCoord2f(tx2, ty2);
+    glVertex2i(x + width, y + height);
+    glTexCoord2f(tx1, ty2);
+    glVertex2i(x, y + height);
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+}
+
+// A layer of a parallax background: a strip that repeats sideways across the screen, and scrolls slower than
+// the camera the farther away it is.
+typedef struct
+{
+    Image image;
+    int y;        // Bottom of the layer on the screen
+    double speed; // Pixels scrolled per pixel the camera moves: 0 for the sky, 1 for the level itself
+} ParallaxLayer;
+
+// Makes a layer from the region (x, y, width, height) of `sheet`, e.g. a row of background tiles. The region is
+// copied into its own texture, as a texture can only repeat as a whole.
+bool iLoadParallaxLayer(ParallaxLayer *layer, Image *sheet, int x, int y, int width, int height, int screenY, double speed)
+{
+    if (!iCropImage(sheet, &layer->image, x, y, width, height))
+        return false;
+    layer->y = screenY;
+    layer->speed = speed;
+    return true;
+}
+
+// Draws the layers in order, each as one quad across the screen, for a camera at `cameraX`.
+void iShowParallaxLayers(ParallaxLayer *layers, int count, double cameraX)
+{
+    for (int i = 0; i < count; i++)
+        iShowScrolledImage(0, layers[i].y, &layers[i].image, iScreenWidth, layers[i].image.height, cameraX * layers[i].speed);
+}
+
+void iFreeParallaxLayer(ParallaxLayer *layer)
+{
+    iFreeImage(&layer->image);
+}
+
+// How the resize functions compute the new pixels.
+enum ResizeFilter
+{
+    RESIZE_SMOOTH,    // Filtered in sRGB space, for photos and painted art
+    RESIZE_PIXEL_ART  // Nearest neighbor, so pixel art stays sharp; integer upscales repeat every pixel exactly
+};
+// Images drawn at another size than their own (see iShowLoadedImage2) are scaled by the GPU, also with
+// nearest-neighbor filtering.
+
+static void iResizeImageData(Image *img, int width, int height, ResizeFilter filter)
+{
+    int channels = img->channels;
+    unsigned char *resizedData = iAllocPixels((size_t)width * height * channels);
+    if (filter == RESIZE_PIXEL_ART)
+        iResizePixelsNearest(img->data, img->width, img->height, resizedData, width, height, channels);
+    else
+        stbir_resize_uint8_srgb(img->data, img->width, img->height, 0, resizedData, width, height, 0,
+                                channels == 4 ? STBIR_RGBA : STBIR_RGB);
+    iFreeImageData(img);
     img->data = resizedData;
+    img->dataOwner = PIXELS_POOLED;
     img->width = width;
     img->height = height;
+}
 
+void iResizeImage(Image *img, int width, int height, ResizeFilter filter = RESIZE_SMOOTH)
+{
+    if (img->width == width && img->height == height)
+        return; // Already the right size, e.g. pre-resized by the asset packer.
+    if (!iRestoreImageData(img))
+        return;
+    iResizeImageData(img, width, height, filter);
     iUpdateTexture(img, true); // Update OpenGL texture after resizing
 }
 
-void iScaleImage(Image *img, double scale)
+void iScaleImage(Image *img, double scale, ResizeFilter filter = RESIZE_SMOOTH)
 {
     if (!img || scale <= 0.0f)
         return;
 
     int newWidth = (int)(img->width * scale);
     int newHeight = (int)(img->height * scale);
-
-    int channels = img->channels;
-    unsigned char *data = img->data;
-    unsigned char *resizedData = new unsigned char[newWidth * newHeight * channels];
-
-    stbir_pixel_layout layout;
-    if (channels == 3)
-        layout = STBIR_RGB;
-    else if (channels == 4)
-        layout = STBIR_RGBA;
-    else
-    {
-        // handle error
-    }
-    stbir_resize_uint8_srgb(data, img->width, img->height, 0, resizedData, newWidth, newHeight, 0, layout);
-    // stbir_resize_uint8(
-    //     data, img->width, img->height, 0,
-    //     resizedData, newWidth, newHeight, 0,
-    //     channels);
-
-    stbi_image_free(data);
-    img->data = resizedData;
-    img->width = newWidth;
-    img->height = newHeight;
-
+    if (newWidth == img->width && newHeight == img->height)
+        return;
+    if (!iRestoreImageData(img))
+        return;
+    iResizeImageData(img, newWidth, newHeight, filter);
     iUpdateTexture(img, true); // Update OpenGL texture after scaling
 }
 
 void iMirrorImage(Image *img, MirrorState state)
 {
+    if (!img->data && img->textureId)
+    {
+        img->mirror = (MirrorState)(img->mirror ^ state); // GPU-resident, see iShowTexture2 and iIsPixelOpaque
+        return;
+    }
+    int profile = iProfileBegin("image", "iMirrorImage");
+    iOwnImageData(img);
     int width = img->width;
     int height = img->height;
     int channels = img->channels;
     unsigned char *data = img->data;
-    unsigned char *mirroredData = new unsigned char[width * height * channels];
-    if (state == HORIZONTAL)
-    {
-        for (int y = 0; y < height; y++)
-        {
-            for (int x = 0; x < width; x++)
-            {
-                int index = (y * width + x) * channels;
-                int mirroredIndex = (y * width + (width - x - 1)) * channels;
-                for (int c = 0; c < channels; c++)
-                {
-                    mirroredData[mirroredIndex + c] = data[index + c];
-                }
-            }
-        }
-    }
-    else if (state == VERTICAL)
+    size_t rowSize = (size_t)width * channels;
+    if (state & HORIZONTAL)
     {
         for (int y = 0; y < height; y++)
-        {
-            int mirroredY = height - y - 1;
-            for (int x = 0; x < width; x++)
-            {
-                int index = (y * width + x) * channels;
-                int mirroredIndex = (mirroredY * width + x) * channels;
-                for (int c = 0; c < channels; c++)
-                {
-                    mirroredData[mirroredIndex + c] = data[index + c];
-                }
-            }
-        }
+            iMirrorPixelRow(data + y * rowSize, width, channels);
     }
-    stbi_image_free(data);
-    img->data = mirroredData;
+    if (state & VERTICAL)
+        iReverseRows(data, height, rowSize);
 
     iUpdateTexture(img); // Update OpenGL texture after mirroring
+    iProfileEnd(profile);
 }
 
 // ignorecolor = hex color code 0xRRGGBB
+// Selects the mask of the current frame. The masks of every frame are built with the frame set, so this neither
+// allocates nor reads pixels. The vertical flip of the sprite is applied when the mask is read (see iSpriteMaskRow).
 void iUpdateCollisionMask(Sprite *s)
 {
-    if (!s || !s->frames)
+    if (!s || !s->frameSet || s->currentFrame < 0 || s->currentFrame >= s->frameSet->frameCount)
     {
         return;
     }
-    Image *frame = &s->frames[s->currentFrame];
-    int width = frame->width;
-    int height = frame->height;
-    int channels = frame->channels;
-    unsigned char *data = frame->data;
+    const FrameRect *frame = &s->frameSet->frames[s->currentFrame];
+    s->collisionMask = s->flipHorizontal ? frame->mirroredCollisionMask : frame->collisionMask;
+}
 
-    if (s->collisionMask != nullptr)
-    {
-        delete[] s->collisionMask;
-    }
+// Row y of the mask of the current frame, as the sprite is drawn.
+static inline const uint64_t *iSpriteMaskRow(const Sprite *s, const FrameRect *frame, int y)
+{
+    if (s->flipVertical)
+        y = frame->height - 1 - y;
+    return s->collisionMask + (size_t)y * iMaskWords(frame->width);
+}
 
-    unsigned char *collisionMask = new unsigned char[width * height];
+// True if the pixel at (x, y) of the current frame, as the sprite is drawn (i.e. flipped), is not transparent.
+static inline bool iIsSpritePixelSolid(const Sprite *s, const FrameRect *frame, int x, int y)
+{
+    return (iSpriteMaskRow(s, frame, y)[x / 64] >> (x % 64)) & 1;
+}
 
-    for (int y = 0; y < height; y++)
+// * Occupancy masks
+// Every frame has a pyramid of coarser masks, where level k has a bit per 2^k x 2^k pixels, set if any of them is
+// set. Level 0 is collisionMask. Regions of any size are checked for set pixels with at most 4 bits.
+static size_t iOccupancyWords(int width, int height)
+{
+    size_t words = 0;
+    while (width > 1 || height > 1)
     {
-        for (int x = 0; x < width; x++)
-        {
-            int index = (y * width + x) * channels;
-            unsigned char a = (channels == 4) ? data[index + 3] : 255;
-            bool isTransparent = (channels == 4 && a == 0);
-            collisionMask[y * width + x] = (isTransparent) ? 0 : 1;
-        }
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        words += (size_t)iMaskWords(width) * height;
     }
-    s->collisionMask = collisionMask;
+    return words;
 }
 
-int iCheckImageSpriteCollision(int x1, int y1, Image *img, Sprite *s)
+// Builds the levels above `mask` (width x height) into `levels`, which holds iOccupancyWords words.
+static void iBuildOccupancy(const uint64_t *mask, int width, int height, uint64_t *levels)
 {
-    if (!img || !s || !s->frames || s->currentFrame < 0 || s->currentFrame >= s->totalFrames)
-        return 0; // Invalid image or sprite
+    while (width > 1 || height > 1)
+    {
+        int levelWidth = (width + 1) / 2, levelHeight = (height + 1) / 2;
+        int words = iMaskWords(width), levelWords = iMaskWords(levelWidth);
+        memset(levels, 0, (size_t)levelWords * levelHeight * sizeof(uint64_t));
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                if ((mask[(size_t)y * words + x / 64] >> (x % 64)) & 1)
+                    levels[(size_t)(y / 2) * levelWords + x / 128] |= (uint64_t)1 << (x / 2 % 64);
+            }
+        }
+        mask = levels;
+        levels += (size_t)levelWords * levelHeight;
+        width = levelWidth;
+        height = levelHeight;
+    }
+}
+
+// False if no pixel of the frame (not flipped) in [x0, x1] x [y0, y1] is set. May be true for some empty regions.
+// Uses the finest level whose cells are at least as large as the region, where it spans at most 2 x 2 cells.
+static bool iMayFrameRegionCollide(const FrameRect *frame, int x0, int y0, int x1, int y1)
+{
+    const uint64_t *level = frame->collisionMask;
+    const uint64_t *nextLevel = frame->occupancyMask;
+    int width = frame->width, height = frame->height;
+    int size = mmax(x1 - x0, y1 - y0) + 1;
+    int shift = 0;
+    while ((1 << shift) < size && (width > 1 || height > 1))
+    {
+        level = nextLevel;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        nextLevel += (size_t)iMaskWords(width) * height;
+        shift++;
+    }
+    int words = iMaskWords(width);
+    for (int y = y0 >> shift; y <= y1 >> shift; y++)
+    {
+        for (int x = x0 >> shift; x <= x1 >> shift; x++)
+        {
+            if ((level[(size_t)y * words + x / 64] >> (x % 64)) & 1)
+                return true;
+        }
+    }
+    return false;
+}
+
+// * Pixel collision
+// The masks of two images or sprites are ANDed a row at a time, 64 pixels per step (see iMaskBits). The iCheck
+// functions count the overlapping pixels, the iHas functions only tell if there is one, and stop at the first.
+#define MAX_MASK_ROW_WORDS 64 // Rows of wider images are built on the heap.
+
+// An image, or the current frame of a sprite, at its position on the screen.
+typedef struct
+{
+    const Image *image;
+    const Sprite *sprite;
+    const FrameRect *frame;
+    int x, y, width, height;
+    uint64_t *rowBits; // For the rows of images that have no mask to read from
+} MaskSource;
+
+static bool iImageMaskSource(MaskSource *source, int x, int y, const Image *img)
+{
+    if (!img || !iIsImageLoaded(img))
+        return false;
+    *source = {img, nullptr, nullptr, x, y, img->width, img->height, nullptr};
+    return true;
+}
+
+static bool iSpriteMaskSource(MaskSource *source, const Sprite *s)
+{
+    if (!s || !s->frameSet || !s->collisionMask || s->currentFrame < 0 || s->currentFrame >= s->totalFrames)
+        return false;
+    const FrameRect *frame = &s->frameSet->frames[s->currentFrame];
+    *source = {nullptr, s, frame, s->x, s->y, frame->width, frame->height, nullptr};
+    return true;
+}
 
-    Image *frame = &s->frames[s->currentFrame];
-    int x2 = s->x;
-    int y2 = s->y;
+// Row y of the mask of an image, as it is drawn. Written to `rowBits` unless the image has the row as is.
+static const uint64_t *iMaskSourceRow(const MaskSource *source, int y)
+{
+    if (source->sprite)
+        return iSpriteMaskRow(source->sprite, source->frame, y);
 
-    // Calculate bounding box overlap
-    int overlapMinX = mmax(x1, x2);
-    int overlapMaxX = mmin(x1 + img->width, x2 + frame->width);
-    int overlapMinY = mmax(y1, y2);
-    int overlapMaxY = mmin(y1 + img->height, y2 + frame->height);
+    const Image *img = source->image;
+    if (img->data && img->channels == 4)
+    {
+        iPixelKernels.alphaMaskRGBA(img->data + (size_t)y * img->width * 4, img->width, source->rowBits);
+        return source->rowBits;
+    }
+    if (!img->data && img->alphaMask)
+    {
+        if (img->mirror & VERTICAL)
+            y = img->height - 1 - y;
+        const uint64_t *row = img->alphaMask + (size_t)y * iAlphaMaskStride(img);
+        if (!(img->mirror & HORIZONTAL))
+            return row;
+        iReverseMaskBits(row, img->width, source->rowBits);
+        return source->rowBits;
+    }
+    memset(source->rowBits, 0xFF, iMaskWords(img->width) * sizeof(uint64_t)); // No alpha channel
+    return source->rowBits;
+}
 
+static int iCountMaskOverlap(MaskSource *a, MaskSource *b, bool isAnyEnough)
+{
+    int overlapMinX = mmax(a->x, b->x);
+    int overlapMaxX = mmin(a->x + a->width, b->x + b->width);
+    int overlapMinY = mmax(a->y, b->y);
+    int overlapMaxY = mmin(a->y + a->height, b->y + b->height);
     if (overlapMinX >= overlapMaxX || overlapMinY >= overlapMaxY)
         return 0; // No overlap
 
+    uint64_t rowBitsA[MAX_MASK_ROW_WORDS], rowBitsB[MAX_MASK_ROW_WORDS];
+    a->rowBits = iMaskWords(a->width) <= MAX_MASK_ROW_WORDS ? rowBitsA : new uint64_t[iMaskWords(a->width)];
+    b->rowBits = iMaskWords(b->width) <= MAX_MASK_ROW_WORDS ? rowBitsB : new uint64_t[iMaskWords(b->width)];
+
     int count = 0;
-    // Check pixel-perfect collision in the overlapping area
     for (int y = overlapMinY; y < overlapMaxY; y++)
     {
-        for (int x = overlapMinX; x < overlapMaxX; x++)
-        {
-            // Get pixel coordinates in both images
-            int localX1 = x - x1;
-            int localY1 = y - y1;
-            int localX2 = x - x2;
-            int localY2 = y - y2;
-
-            if (localX1 < 0 || localY1 < 0 || localX1 >= img->width || localY1 >= img->height ||
-                localX2 < 0 || localY2 < 0 || localX2 >= frame->width || localY2 >= frame->height)
-                continue;
+        int rowCount = iPixelKernels.andMaskBits(iMaskSourceRow(a, y - a->y), overlapMinX - a->x,
+                                                 iMaskSourceRow(b, y - b->y), overlapMinX - b->x,
+                                                 overlapMaxX - overlapMinX, isAnyEnough);
+        count += rowCount;
+        if (rowCount != 0 && isAnyEnough)
+            break;
+    }
 
-            unsigned char *pixel1 = &img->data[(localY1 * img->width + localX1) * img->channels];
-            unsigned char *pixel2 = &frame->data[(localY2 * frame->width + localX2) * frame->channels];
+    if (a->rowBits != rowBitsA)
+        delete[] a->rowBits;
+    if (b->rowBits != rowBitsB)
+        delete[] b->rowBits;
+    return count;
+}
 
-            // Check if both pixels are not transparent
-            bool isPixel1Transparent = (img->channels == 4 && pixel1[3] == 0);
-            bool isPixel2Transparent = (frame->channels == 4 && pixel2[3] == 0);
+int iCheckImageSpriteCollision(int x1, int y1, Image *img, Sprite *s)
+{
+    MaskSource a, b;
+    if (!iImageMaskSource(&a, x1, y1, img) || !iSpriteMaskSource(&b, s))
+        return 0; // Invalid image or sprite
+    return iCountMaskOverlap(&a, &b, false);
+}
 
-            if (!isPixel1Transparent && !isPixel2Transparent)
-            {
-                // Both pixels are opaque, collision detected
-                count++;
-            }
-        }
-    }
-    return count;
+bool iHasImageSpriteCollision(int x1, int y1, Image *img, Sprite *s)
+{
+    MaskSource a, b;
+    return iImageMaskSource(&a, x1, y1, img) && iSpriteMaskSource(&b, s) && iCountMaskOverlap(&a, &b, true) != 0;
 }
 
 int iCheckImageCollision(int x1, int y1, Image *img1, int x2, int y2, Image *img2)
 {
-    if (!img1 || !img2 || !img1->data || !img2->data)
+    MaskSource a, b;
+    if (!iImageMaskSource(&a, x1, y1, img1) || !iImageMaskSource(&b, x2, y2, img2))
         return 0; // Invalid images
+    return iCountMaskOverlap(&a, &b, false);
+}
 
-    int w1 = img1->width, h1 = img1->height;
-    int w2 = img2->width, h2 = img2->height;
+bool iHasImageCollision(int x1, int y1, Image *img1, int x2, int y2, Image *img2)
+{
+    MaskSource a, b;
+    return iImageMaskSource(&a, x1, y1, img1) && iImageMaskSource(&b, x2, y2, img2) && iCountMaskOverlap(&a, &b, true) != 0;
+}
 
-    // Calculate bounding box overlap
-    int overlapMinX = mmax(x1, x2);
-    int overlapMaxX = mmin(x1 + w1, x2 + w2);
-    int overlapMinY = mmax(y1, y2);
-    int overlapMaxY = mmin(y1 + h1, y2 + h2);
+// * Rotated pixel collision
+#define COLLISION_BLOCK_SIZE 16 // Screen pixels per side of the blocks that are tested against the occupancy masks
 
-    if (overlapMinX >= overlapMaxX || overlapMinY >= overlapMaxY)
-        return 0; // No overlap
+#define COLLISION_FIXED_SHIFT 16 // Fractional bits of the local coordinates that rotated sprites are sampled at
 
-    int count = 0;
-    // Check pixel-perfect collision in the overlapping area
-    for (int y = overlapMinY; y < overlapMaxY; y++)
-    {
-        for (int x = overlapMinX; x < overlapMaxX; x++)
-        {
-            // Get pixel coordinates in both images
-            int localX1 = x - x1;
-            int localY1 = y - y1;
-            int localX2 = x - x2;
-            int localY2 = y - y2;
-
-            if (localX1 < 0 || localY1 < 0 || localX1 >= w1 || localY1 >= h1 ||
-                localX2 < 0 || localY2 < 0 || localX2 >= w2 || localY2 >= h2)
-                continue;
+// Maps screen pixels to the pixels of a rotated sprite (before its flips), in fixed point. The local coordinates are
+// exactly linear in the screen coordinates, so stepping along a row by cosT and sinT gives the same samples as
+// computing every pixel on its own.
+typedef struct
+{
+    int64_t cosT, sinT;
+    int64_t originX, originY; // The local coordinates of the screen pixel (0, 0)
+} SpriteTransform;
 
-            unsigned char *pixel1 = &img1->data[(localY1 * w1 + localX1) * img1->channels];
-            unsigned char *pixel2 = &img2->data[(localY2 * w2 + localX2) * img2->channels];
+static void iMakeSpriteTransform(const Sprite *s, float theta, SpriteTransform *t)
+{
+    const double one = (double)(1 << COLLISION_FIXED_SHIFT);
+    t->cosT = llround(cos(theta) * one);
+    t->sinT = llround(sin(theta) * one);
+    double cosT = t->cosT / one, sinT = t->sinT / one;
+    t->originX = llround((s->rotationCenterX - s->x - cosT * s->rotationCenterX - sinT * s->rotationCenterY) * one);
+    t->originY = llround((s->rotationCenterY - s->y + sinT * s->rotationCenterX - cosT * s->rotationCenterY) * one);
+}
 
-            // Check if both pixels are not transparent
-            bool isPixel1Transparent = (img1->channels == 4 && pixel1[3] == 0);
-            bool isPixel2Transparent = (img2->channels == 4 && pixel2[3] == 0);
+// The pixel of a rotated sprite that the screen pixel (x, y) samples, in fixed point.
+static inline void iToSpriteLocal(const SpriteTransform *t, int x, int y, int64_t *localX, int64_t *localY)
+{
+    *localX = t->originX + t->cosT * x + t->sinT * y;
+    *localY = t->originY - t->sinT * x + t->cosT * y;
+}
 
-            if (!isPixel1Transparent && !isPixel2Transparent)
-            {
-                // Both pixels are opaque, collision detected
-                count++;
-            }
-        }
+// Narrows the steps [first, last] of a row to those where `start + step * i` may be in [0, size), plus a step on
+// both sides for rounding. The steps in the span are still checked one by one.
+static inline void iClipRotatedSpan(int64_t start, int64_t step, int size, int *first, int *last)
+{
+    int64_t end = (int64_t)size << COLLISION_FIXED_SHIFT;
+    if (step == 0)
+    {
+        if (start < 0 || start >= end)
+            *last = *first - 1; // Never in range
+        return;
     }
-    return count;
+    double enter = (double)(0 - start) / step, leave = (double)(end - start) / step;
+    if (enter > leave)
+        sswap(enter, leave);
+    *first = (int)mmax((double)*first, floor(enter) - 1);
+    *last = (int)mmin((double)*last, ceil(leave) + 1);
 }
 
-int iCheckCollision(Sprite *s1, Sprite *s2)
+// False if the screen pixels [x0, x1] x [y0, y1] only sample empty pixels of the current frame of a rotated
+// sprite, or none of it. The samples are bounded by the local coordinates of the corners.
+static bool iMayRotatedBlockCollide(const Sprite *s, const FrameRect *frame, const SpriteTransform *t, int x0, int y0, int x1, int y1)
+{
+    int64_t minX = INT64_MAX, maxX = INT64_MIN;
+    int64_t minY = INT64_MAX, maxY = INT64_MIN;
+    for (int i = 0; i < 4; i++)
+    {
+        int64_t localX, localY;
+        iToSpriteLocal(t, i % 2 ? x1 : x0, i / 2 ? y1 : y0, &localX, &localY);
+        minX = mmin(minX, localX);
+        maxX = mmax(maxX, localX);
+        minY = mmin(minY, localY);
+        maxY = mmax(maxY, localY);
+    }
+    int64_t width = (int64_t)frame->width << COLLISION_FIXED_SHIFT, height = (int64_t)frame->height << COLLISION_FIXED_SHIFT;
+    if (maxX < 0 || maxY < 0 || minX >= width || minY >= height)
+        return false;
+    int left = (int)(mmax(minX, (int64_t)0) >> COLLISION_FIXED_SHIFT);
+    int right = (int)(mmin(maxX, width - 1) >> COLLISION_FIXED_SHIFT);
+    int bottom = (int)(mmax(minY, (int64_t)0) >> COLLISION_FIXED_SHIFT);
+    int top = (int)(mmin(maxY, height - 1) >> COLLISION_FIXED_SHIFT);
+    if (s->flipHorizontal)
+    {
+        int flippedLeft = frame->width - 1 - right;
+        right = frame->width - 1 - left;
+        left = flippedLeft;
+    }
+    if (s->flipVertical)
+    {
+        int flippedBottom = frame->height - 1 - top;
+        top = frame->height - 1 - bottom;
+        bottom = flippedBottom;
+    }
+    return iMayFrameRegionCollide(frame, left, bottom, right, top);
+}
+
+static int iCountSpriteOverlap(Sprite *s1, Sprite *s2, bool isAnyEnough)
 {
     // Early exit if invalid sprites or missing frames/masks
-    if (!s1 || !s2 || !s1->frames || !s2->frames || !s1->collisionMask || !s2->collisionMask)
+    MaskSource a, b;
+    if (!iSpriteMaskSource(&a, s1) || !iSpriteMaskSource(&b, s2))
         return 0;
+    if (s1->rotation == 0 && s2->rotation == 0)
+        return iCountMaskOverlap(&a, &b, isAnyEnough);
 
-    Image *frame1 = &s1->frames[s1->currentFrame];
-    Image *frame2 = &s2->frames[s2->currentFrame];
+    const FrameRect *frame1 = &s1->frameSet->frames[s1->currentFrame];
+    const FrameRect *frame2 = &s2->frameSet->frames[s2->currentFrame];
     int w1 = frame1->width, h1 = frame1->height;
     int w2 = frame2->width, h2 = frame2->height;
 
@@ -830,6 +1272,9 @@ int iCheckCollision(Sprite *s1, Sprite *s2)
     float theta2 = s2->rotation * (3.14159265f / 180.0f);
     float cos1 = cosf(theta1), sin1 = sinf(theta1);
     float cos2 = cosf(theta2), sin2 = sinf(theta2);
+    SpriteTransform t1, t2;
+    iMakeSpriteTransform(s1, theta1, &t1);
+    iMakeSpriteTransform(s2, theta2, &t2);
 
     // Helper function to compute rotated AABB (global pivot version)
     auto computeRotatedAABB = [](float x, float y, int w, int h,
@@ -887,52 +1332,59 @@ int iCheckCollision(Sprite *s1, Sprite *s2)
     if (overlapMinX >= overlapMaxX || overlapMinY >= overlapMaxY)
         return 0; // No AABB overlap
 
-    // printf("AABB Overlap\n");
-
-    // Precompute inverse rotations (for screen-to-local transform)
-    float invCos1 = cos1, invSin1 = -sin1; // cos(-θ) = cos(θ), sin(-θ) = -sin(θ)
-    float invCos2 = cos2, invSin2 = -sin2;
-
+    // Pixel-perfect check in the overlap region, a block at a time. Blocks that only cover empty cells of either
+    // mask are skipped. Each row is first narrowed to the pixels that may be inside both sprites, and along it the
+    // local coordinates advance by a constant fixed-point step per pixel.
     int count = 0; // Count of overlapping pixels
-    // Pixel-perfect check in overlap region
-    for (int y = overlapMinY; y <= overlapMaxY; y++)
+    int rowFirst[COLLISION_BLOCK_SIZE], rowLast[COLLISION_BLOCK_SIZE];
+    for (int blockY = overlapMinY; blockY <= overlapMaxY; blockY += COLLISION_BLOCK_SIZE)
     {
-        for (int x = overlapMinX; x <= overlapMaxX; x++)
+        int lastY = mmin(blockY + COLLISION_BLOCK_SIZE - 1, overlapMaxY);
+        for (int y = blockY; y <= lastY; y++)
         {
-            // Transform to Sprite 1's local space
-            float dx1 = x - s1->rotationCenterX;
-            float dy1 = y - s1->rotationCenterY;
-            float localX1 = invCos1 * dx1 - invSin1 * dy1 + (s1->rotationCenterX - s1->x);
-            float localY1 = invSin1 * dx1 + invCos1 * dy1 + (s1->rotationCenterY - s1->y);
-
-            if (localX1 < 0 || localY1 < 0 || localX1 >= w1 || localY1 >= h1)
-                continue;
-
-            // Transform to Sprite 2's local space
-            float dx2 = x - s2->rotationCenterX;
-            float dy2 = y - s2->rotationCenterY;
-            float localX2 = invCos2 * dx2 - invSin2 * dy2 + (s2->rotationCenterX - s2->x);
-            float localY2 = invSin2 * dx2 + invCos2 * dy2 + (s2->rotationCenterY - s2->y);
+            int64_t localX1, localY1, localX2, localY2;
+            iToSpriteLocal(&t1, overlapMinX, y, &localX1, &localY1);
+            iToSpriteLocal(&t2, overlapMinX, y, &localX2, &localY2);
+            int first = 0, last = overlapMaxX - overlapMinX;
+            iClipRotatedSpan(localX1, t1.cosT, w1, &first, &last);
+            iClipRotatedSpan(localY1, -t1.sinT, h1, &first, &last);
+            iClipRotatedSpan(localX2, t2.cosT, w2, &first, &last);
+            iClipRotatedSpan(localY2, -t2.sinT, h2, &first, &last);
+            rowFirst[y - blockY] = overlapMinX + first;
+            rowLast[y - blockY] = overlapMinX + last;
+        }
 
-            if (localX2 < 0 || localY2 < 0 || localX2 >= w2 || localY2 >= h2)
+        for (int blockX = overlapMinX; blockX <= overlapMaxX; blockX += COLLISION_BLOCK_SIZE)
+        {
+            int lastX = mmin(blockX + COLLISION_BLOCK_SIZE - 1, overlapMaxX);
+            if (!iMayRotatedBlockCollide(s1, frame1, &t1, blockX, blockY, lastX, lastY) ||
+                !iMayRotatedBlockCollide(s2, frame2, &t2, blockX, blockY, lastX, lastY))
                 continue;
 
-            // Check collision masks (with nearest-neighbor sampling)
-            int ix1 = (int)localX1, iy1 = (int)localY1;
-            int ix2 = (int)localX2, iy2 = (int)localY2;
-
-            if (ix1 >= 0 && iy1 >= 0 && ix1 < w1 && iy1 < h1 &&
-                ix2 >= 0 && iy2 >= 0 && ix2 < w2 && iy2 < h2)
+            for (int y = blockY; y <= lastY; y++)
             {
-                int idx1 = iy1 * w1 + ix1;
-                int idx2 = iy2 * w2 + ix2;
-                if (s1->collisionMask[idx1] && s2->collisionMask[idx2])
+                int firstX = mmax(blockX, rowFirst[y - blockY]), endX = mmin(lastX, rowLast[y - blockY]);
+                if (firstX > endX)
+                    continue;
+                int64_t localX1, localY1, localX2, localY2;
+                iToSpriteLocal(&t1, firstX, y, &localX1, &localY1);
+                iToSpriteLocal(&t2, firstX, y, &localX2, &localY2);
+                for (int x = firstX; x <= endX; x++, localX1 += t1.cosT, localY1 -= t1.sinT, localX2 += t2.cosT, localY2 -= t2.sinT)
                 {
-
-                    count++;
-                    // printf("Collision at pixel (%d, %d)\n", x, y);
-                    // If you want to return immediately on first collision, uncomment the next line
-                    // return 1;
+                    int pixelX1 = (int)(localX1 >> COLLISION_FIXED_SHIFT), pixelY1 = (int)(localY1 >> COLLISION_FIXED_SHIFT);
+                    int pixelX2 = (int)(localX2 >> COLLISION_FIXED_SHIFT), pixelY2 = (int)(localY2 >> COLLISION_FIXED_SHIFT);
+                    if (localX1 < 0 || localY1 < 0 || pixelX1 >= w1 || pixelY1 >= h1 ||
+                        localX2 < 0 || localY2 < 0 || pixelX2 >= w2 || pixelY2 >= h2)
+                        continue;
+
+                    // Check collision masks (with nearest-neighbor sampling)
+                    if (iIsSpritePixelSolid(s1, frame1, pixelX1, pixelY1) &&
+                        iIsSpritePixelSolid(s2, frame2, pixelX2, pixelY2))
+                    {
+                        count++;
+                        if (isAnyEnough)
+                            return 1;
+                    }
                 }
             }
         }
@@ -940,6 +1392,16 @@ int iCheckCollision(Sprite *s1, Sprite *s2)
     return count;
 }
 
+int iCheckCollision(Sprite *s1, Sprite *s2)
+{
+    return iCountSpriteOverlap(s1, s2, false);
+}
+
+bool iHasCollision(Sprite *s1, Sprite *s2)
+{
+    return iCountSpriteOverlap(s1, s2, true) != 0;
+}
+
 void iRotateSprite(Sprite *s, double x, double y, double degree)
 {
     if (!s)
@@ -1013,7 +1475,7 @@ void iRotateSprite(Sprite *s, double x, double y, double degree)
 
 void iAnimateSprite(Sprite *sprite)
 {
-    if (!sprite || sprite->totalFrames <= 1 || !sprite->frames)
+    if (!sprite || sprite->totalFrames <= 1 || !sprite->frameSet)
         return;
 
     sprite->currentFrame = (sprite->currentFrame + 1) % sprite->totalFrames;
@@ -1029,8 +1491,10 @@ int compareFilenames(const void *a, const void *b)
 }
 void iAllocateTexture(Image *img)
 {
+    iCheckTextureUpload(img);
     GLuint texId;
     glGenTextures(1, &texId);
+    iTrackTextureCreate();
     glBindTexture(GL_TEXTURE_2D, texId);
     // Set texture parameters ONCE
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -1044,6 +1508,7 @@ void iAllocateTexture(Image *img)
     img->textureId = texId;
 }
 
+// Copies every frame into an image of its own. iLoadFrameSetFromSheet keeps the sheet as one texture instead.
 void iLoadFramesFromSheet2(Image *frames, const char *filename, int rows, int cols, int ignoreColor = -1)
 {
     // Load the sprite sheet image
@@ -1068,7 +1533,12 @@ void iLoadFramesFromSheet2(Image *frames, const char *filename, int rows, int co
         frame->width = frameWidth;
         frame->height = frameHeight;
         frame->channels = tmp.channels;
-        frame->data = new unsigned char[frameWidth * frameHeight * frame->channels];
+        frame->isSVG = false;
+        frame->dataOwner = PIXELS_POOLED;
+        frame->textureId = 0;
+        frame->alphaMask = nullptr;
+        frame->mirror = NO_MIRROR;
+        frame->data = iAllocPixels((size_t)frameWidth * frameHeight * frame->channels);
 
         for (int y = 0; y < frameHeight; ++y)
         {
@@ -1089,7 +1559,7 @@ void iLoadFramesFromSheet2(Image *frames, const char *filename, int rows, int co
         // iAllocateTexture(frame); // Set the texture ID for the frame
     }
 
-    delete[] tmp.data;
+    iFreeImageData(&tmp);
 }
 
 void iLoadFramesFromSheet(Image *frames, const char *filename, int rows, int cols)
@@ -1100,57 +1570,1258 @@ void iLoadFramesFromSheet(Image *frames, const char *filename, int rows, int col
 #define MAX_FILES 1024
 #define MAX_FILENAME_LEN 512
 
-void iLoadFramesFromFolder2(Image *frames, const char *folderPath, int ignoreColor = -1)
+// Lists the images of a folder in the open asset pack, in the same (sorted) order as the folder.
+// Returns the number of paths stored in `paths` (allocated with strdup), 0 if the pack has no images in that folder.
+int iListPackFolder(const char *folderPath, char **paths)
+{
+    if (!iAssetPack.base)
+        return 0;
+
+    char prefix[MAX_PACK_NAME_LEN];
+    iNormalizePackName(prefix, folderPath, MAX_PACK_NAME_LEN - 1);
+    int prefixLength = strlen(prefix);
+    if (prefixLength > 0 && prefix[prefixLength - 1] != '/')
+    {
+        prefix[prefixLength++] = '/';
+        prefix[prefixLength] = '\0';
+    }
+
+    int count = 0;
+    for (int i = iLowerBoundPackEntry(prefix); i < iAssetPack.entryCount && count < MAX_FILES; i++)
+    {
+        const PackEntry *entry = &iAssetPack.entries[i];
+        if (strncmp(entry->name, prefix, prefixLength) != 0)
+            break;
+        if (strchr(entry->name + prefixLength, '/') != nullptr || entry->type != PACK_IMAGE)
+            continue; // Inside a subfolder
+        paths[count] = strdup(entry->name);
+        if (paths[count] != NULL)
+            count++;
+    }
+    return count;
+}
+
+// Lists the files of a folder in sorted order, from the asset pack if it has the folder.
+// Returns the number of full paths stored in `paths`; free them with free().
+int iListFrameFiles(const char *folderPath, char **paths)
 {
+    int count = iListPackFolder(folderPath, paths);
+    if (count > 0)
+        return count;
+
     DIR *dir = opendir(folderPath);
     if (dir == nullptr)
     {
         fprintf(stderr, "ERROR: Failed to open directory: %s\n", folderPath);
+        return 0;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && count < MAX_FILES)
+    {
+        const char *name = entry->d_name;
+
+        // Skip "." and ".."
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+
+        // Build full path to check if it's a directory
+        char fullPath[MAX_FILENAME_LEN];
+        snprintf(fullPath, sizeof(fullPath), "%s/%s", folderPath, name);
+
+        struct stat st;
+        if (stat(fullPath, &st) == 0 && S_ISDIR(st.st_mode))
+            continue;
+
+        // Optionally filter image files (uncomment if needed)
+        paths[count] = strdup(fullPath);
+        if (paths[count] != NULL)
+            count++;
+    }
+    closedir(dir);
+
+    // Sort filenames alphabetically
+    qsort(paths, count, sizeof(char *), compareFilenames);
+    return count;
+}
+
+void iLoadFramesFromFolder2(Image *frames, const char *folderPath, int ignoreColor = -1)
+{
+    char *paths[MAX_FILES];
+    int count = iListFrameFiles(folderPath, paths);
+
+    // Load images in sorted order
+    for (int i = 0; i < count; ++i)
+    {
+        iLoadImage2(&frames[i], paths[i], ignoreColor);
+        free(paths[i]); // free allocated memory
+    }
+}
+
+void iLoadFramesFromFolder(Image *frames, const char *folderPath)
+{
+    iLoadFramesFromFolder2(frames, folderPath);
+}
+
+// * Background jobs
+// A pool of worker threads, one per core besides the main thread, for CPU work such as decoding images.
+// Jobs are submitted and waited for on the main thread, which runs queued jobs itself while it waits.
+#define MAX_JOBS 512
+#define MAX_WORKER_THREADS 16
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION iMutex;
+typedef HANDLE iSemaphore;
+#else
+typedef pthread_mutex_t iMutex;
+typedef sem_t iSemaphore;
+#endif
+
+enum JobState
+{
+    JOB_FREE,
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE
+};
+
+typedef struct
+{
+    void (*run)(void *);
+    void *arg;
+    int state; // JobState, guarded by iJobMutex
+} Job;
+
+Job iJobs[MAX_JOBS];
+int iJobQueue[MAX_JOBS]; // Ring buffer of queued job handles
+int iJobQueueHead = 0, iJobQueueCount = 0;
+int iWorkerCount = 0;
+bool iWorkersStarted = false;
+iMutex iJobMutex;
+iSemaphore iJobsQueued;   // Posted once per queued job, waited on by the workers
+iSemaphore iJobsFinished; // Posted once per finished job, waited on by the main thread
+
+void iMutexInit(iMutex *mutex)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void iMutexLock(iMutex *mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void iMutexUnlock(iMutex *mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+void iSemaphoreInit(iSemaphore *semaphore)
+{
+#ifdef _WIN32
+    *semaphore = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+#else
+    sem_init(semaphore, 0, 0);
+#endif
+}
+
+void iSemaphorePost(iSemaphore *semaphore)
+{
+#ifdef _WIN32
+    ReleaseSemaphore(*semaphore, 1, NULL);
+#else
+    sem_post(semaphore);
+#endif
+}
+
+void iSemaphoreWait(iSemaphore *semaphore)
+{
+#ifdef _WIN32
+    WaitForSingleObject(*semaphore, INFINITE);
+#else
+    while (sem_wait(semaphore) != 0)
+        ; // Interrupted by a signal
+#endif
+}
+
+int iGetCoreCount()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+// Pops the oldest queued job and runs it on the calling thread. Returns false if the queue is empty.
+bool iRunQueuedJob()
+{
+    iMutexLock(&iJobMutex);
+    if (iJobQueueCount == 0)
+    {
+        iMutexUnlock(&iJobMutex);
+        return false;
+    }
+    int handle = iJobQueue[iJobQueueHead];
+    iJobQueueHead = (iJobQueueHead + 1) % MAX_JOBS;
+    iJobQueueCount--;
+    iJobs[handle].state = JOB_RUNNING;
+    iMutexUnlock(&iJobMutex);
+
+    // Jobs are not profiled or allocation tracked, wherever they run, so the reports do not
+    // depend on which thread happened to pick them up.
+    bool wasWorkerThread = iIsWorkerThread;
+    iIsWorkerThread = true;
+    iJobs[handle].run(iJobs[handle].arg);
+    iIsWorkerThread = wasWorkerThread;
+
+    iMutexLock(&iJobMutex);
+    iJobs[handle].state = JOB_DONE;
+    iMutexUnlock(&iJobMutex);
+    iSemaphorePost(&iJobsFinished);
+    return true;
+}
+
+#ifdef _WIN32
+DWORD WINAPI iWorkerMain(LPVOID)
+#else
+void *iWorkerMain(void *)
+#endif
+{
+    iIsWorkerThread = true;
+    while (true)
+    {
+        iSemaphoreWait(&iJobsQueued);
+        iRunQueuedJob(); // The queue may already be empty if the main thread took the job.
+    }
+    return 0;
+}
+
+// Starts the worker threads. Called by the first iSubmitJob; call it earlier to choose the thread count.
+// With count = -1, one thread per core is started, minus one for the main thread.
+void iStartWorkers(int count = -1)
+{
+    if (iWorkersStarted)
         return;
+    iWorkersStarted = true;
+    iGetTimeMs(); // Fixes the clock origin before worker threads could race to set it.
+    iMutexInit(&iJobMutex);
+    iSemaphoreInit(&iJobsQueued);
+    iSemaphoreInit(&iJobsFinished);
+
+    if (count < 0)
+        count = iGetCoreCount() - 1;
+    count = mmin(count, MAX_WORKER_THREADS);
+    for (int i = 0; i < count; i++)
+    {
+#ifdef _WIN32
+        HANDLE thread = CreateThread(NULL, 0, iWorkerMain, NULL, 0, NULL);
+        if (thread == NULL)
+            break;
+        CloseHandle(thread);
+#else
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, iWorkerMain, NULL) != 0)
+            break;
+        pthread_detach(thread);
+#endif
+        iWorkerCount++;
+    }
+    // Without workers, jobs still run: the main thread runs them in iWaitJob.
+}
+
+// Queues `run(arg)` for the worker threads and returns a handle to pass to iWaitJob.
+// If every job slot is taken, the job is run right away and -1 is returned.
+int iSubmitJob(void (*run)(void *), void *arg)
+{
+    iStartWorkers();
+
+    iMutexLock(&iJobMutex);
+    int handle = -1;
+    for (int i = 0; i < MAX_JOBS; i++)
+    {
+        if (iJobs[i].state == JOB_FREE)
+        {
+            handle = i;
+            break;
+        }
+    }
+    if (handle < 0)
+    {
+        iMutexUnlock(&iJobMutex);
+        run(arg);
+        return -1;
+    }
+    iJobs[handle].run = run;
+    iJobs[handle].arg = arg;
+    iJobs[handle].state = JOB_QUEUED;
+    iJobQueue[(iJobQueueHead + iJobQueueCount) % MAX_JOBS] = handle;
+    iJobQueueCount++;
+    iMutexUnlock(&iJobMutex);
+
+    iSemaphorePost(&iJobsQueued);
+    return handle;
+}
+
+bool iIsJobDone(int handle)
+{
+    if (handle < 0)
+        return true;
+    iMutexLock(&iJobMutex);
+    bool done = iJobs[handle].state == JOB_DONE;
+    iMutexUnlock(&iJobMutex);
+    return done;
+}
+
+// Waits for a job to finish and frees its handle. Must be called on the main thread.
+void iWaitJob(int handle)
+{
+    if (handle < 0)
+        return;
+    while (!iIsJobDone(handle))
+    {
+        // Help with the queue instead of idling; sleep only when every job is already running.
+        if (!iRunQueuedJob())
+            iSemaphoreWait(&iJobsFinished);
+    }
+    iMutexLock(&iJobMutex);
+    iJobs[handle].state = JOB_FREE;
+    iMutexUnlock(&iJobMutex);
+}
+
+// * Pixel buffer pool
+// The pixel buffers of the functions that change the size of an image, e.g. iResizeImage, come from here.
+// Freed buffers are kept per power-of-two size class and handed out again, so resizing frames at load
+// time or on the fly does not churn the heap. Every buffer starts with a header holding its size class.
+#define PIXEL_POOL_MIN_CLASS 12  // 4 KB
+#define PIXEL_POOL_CLASS_COUNT 12 // up to 8 MB. Larger buffers are not pooled.
+#define PIXEL_POOL_MAX_FREE 8    // Freed buffers kept per size class
+#define PIXEL_POOL_HEADER_SIZE 32 // Keeps the pixels 32-byte aligned for the SIMD kernels, if malloc does
+
+typedef struct
+{
+    unsigned char *freeBuffers[PIXEL_POOL_MAX_FREE]; // Including their headers
+    int freeCount;
+} PixelPoolClass;
+
+PixelPoolClass iPixelPool[PIXEL_POOL_CLASS_COUNT];
+iMutex iPixelPoolMutex; // Images are resized on the worker threads too.
+static bool iIsPixelPoolMutexReady = (iMutexInit(&iPixelPoolMutex), true);
+
+static int iPixelSizeClass(size_t size)
+{
+    int sizeClass = 0;
+    while (sizeClass < PIXEL_POOL_CLASS_COUNT && ((size_t)1 << (PIXEL_POOL_MIN_CLASS + sizeClass)) < size)
+        sizeClass++;
+    return sizeClass < PIXEL_POOL_CLASS_COUNT ? sizeClass : -1;
+}
+
+// Returns a buffer of at least `size` bytes. Free it with iFreePixels (or, for image data, iFreeImageData
+// with PIXELS_POOLED as the owner).
+unsigned char *iAllocPixels(size_t size)
+{
+    int sizeClass = iPixelSizeClass(size);
+    unsigned char *buffer = nullptr;
+    if (sizeClass >= 0)
+    {
+        iMutexLock(&iPixelPoolMutex);
+        PixelPoolClass *poolClass = &iPixelPool[sizeClass];
+        if (poolClass->freeCount > 0)
+            buffer = poolClass->freeBuffers[--poolClass->freeCount];
+        iMutexUnlock(&iPixelPoolMutex);
+        size = (size_t)1 << (PIXEL_POOL_MIN_CLASS + sizeClass);
+    }
+    if (!buffer)
+        buffer = (unsigned char *)iTrackedMalloc(PIXEL_POOL_HEADER_SIZE + size);
+    *(int *)buffer = sizeClass;
+    return buffer + PIXEL_POOL_HEADER_SIZE;
+}
+
+void iFreePixels(unsigned char *pixels)
+{
+    if (!pixels)
+        return;
+    unsigned char *buffer = pixels - PIXEL_POOL_HEADER_SIZE;
+    int sizeClass = *(int *)buffer;
+    if (sizeClass >= 0)
+    {
+        iMutexLock(&iPixelPoolMutex);
+        PixelPoolClass *poolClass = &iPixelPool[sizeClass];
+        bool isKept = poolClass->freeCount < PIXEL_POOL_MAX_FREE;
+        if (isKept)
+            poolClass->freeBuffers[poolClass->freeCount++] = buffer;
+        iMutexUnlock(&iPixelPoolMutex);
+        if (isKept)
+            return;
+    }
+    iTrackedFree(buffer);
+}
+
+// Frees the buffers that the pool keeps for reuse.
+void iTrimPixelPool()
+{
+    iMutexLock(&iPixelPoolMutex);
+    for (int i = 0; i < PIXEL_POOL_CLASS_COUNT; i++)
+    {
+        while (iPixelPool[i].freeCount > 0)
+            iTrackedFree(iPixelPool[i].freeBuffers[--iPixelPool[i].freeCount]);
+    }
+    iMutexUnlock(&iPixelPoolMutex);
+}
+
+// * Asynchronous image loading
+// Decoding (and resizing) runs on the worker threads. The texture is uploaded on the main thread when
+// the load is waited for, or on first draw if the window did not exist yet.
+typedef struct
+{
+    Image *img;
+    char filename[MAX_FILENAME_LEN];
+    int ignoreColor;
+    int width, height; // Size to resize to, -1 to keep the decoded size
+    ResizeFilter filter;
+    bool loaded;
+    double startMs, durationMs;
+} ImageLoad;
+
+ImageLoad *iImageLoads[MAX_JOBS]; // Indexed by job handle
+
+void iRunImageLoad(void *arg)
+{
+    ImageLoad *load = (ImageLoad *)arg;
+    load->startMs = iGetTimeMs();
+    load->loaded = iLoadImage2(load->img, load->filename, load->ignoreColor);
+    if (load->loaded && load->width > 0 && load->height > 0)
+        iResizeImage(load->img, load->width, load->height, load->filter);
+    load->durationMs = iGetTimeMs() - load->startMs;
+}
+
+bool iFinishImageLoad(ImageLoad *load)
+{
+    bool loaded = load->loaded;
+    iProfileRecord("image", load->filename, load->startMs, load->durationMs);
+    if (loaded && windowCreated)
+        iLoadTexture(load->img);
+    delete load;
+    return loaded;
+}
+
+// Starts loading an image in the background and returns a handle to pass to iWaitImage.
+// `img` must not be used until then. Returns -1 if the image was loaded right away instead.
+int iLoadImageAsync(Image *img, const char *filename, int ignoreColor = -1, int width = -1, int height = -1, ResizeFilter filter = RESIZE_SMOOTH)
+{
+    ImageLoad *load = new ImageLoad;
+    load->img = img;
+    snprintf(load->filename, sizeof(load->filename), "%s", filename);
+    load->ignoreColor = ignoreColor;
+    load->width = width;
+    load->height = height;
+    load->filter = filter;
+    load->loaded = false;
+    img->data = nullptr;
+    img->textureId = 0;
+    img->alphaMask = nullptr;
+
+    int handle = iSubmitJob(iRunImageLoad, load);
+    if (handle < 0)
+    {
+        iFinishImageLoad(load);
+        return -1;
+    }
+    iImageLoads[handle] = load;
+    return handle;
+}
+
+// Waits for an image started with iLoadImageAsync. Returns false if it failed to load.
+bool iWaitImage(int handle)
+{
+    if (handle < 0)
+        return true;
+    iWaitJob(handle);
+    ImageLoad *load = iImageLoads[handle];
+    iImageLoads[handle] = nullptr;
+    return iFinishImageLoad(load);
+}
+
+// Waits for several images. Returns false if any of them failed to load.
+bool iWaitImages(const int *handles, int count)
+{
+    bool loaded = true;
+    for (int i = 0; i < count; i++)
+        loaded = iWaitImage(handles[i]) && loaded;
+    return loaded;
+}
+
+// Starts loading the frames of a folder like iLoadFramesFromFolder2, optionally resizing each frame.
+// Stores one handle per frame in `handles` and returns the number of frames.
+int iLoadFramesFromFolderAsync(Image *frames, const char *folderPath, int *handles, int ignoreColor = -1, int width = -1, int height = -1,
+                               ResizeFilter filter = RESIZE_SMOOTH)
+{
+    char *paths[MAX_FILES];
+    int count = iListFrameFiles(folderPath, paths);
+    for (int i = 0; i < count; ++i)
+    {
+        handles[i] = iLoadImageAsync(&frames[i], paths[i], ignoreColor, width, height, filter);
+        free(paths[i]);
+    }
+    return count;
+}
+
+// * Frame sets
+// A sprite sheet stays one image, and its frames are rectangles of it, so a whole animation is one texture and
+// animating only changes the texture coordinates. Frames loaded as separate images are packed into an atlas.
+// Frame sets are reference counted, so many sprites can share one; a shared frame set is never changed.
+#define FRAME_PADDING 1 // Transparent pixels between packed frames, so rotated or scaled frames do not bleed.
+
+static void iSetFrameRect(FrameSet *set, int i, int x, int y, int width, int height)
+{
+    FrameRect *frame = &set->frames[i];
+    frame->x = x;
+    frame->y = y;
+    frame->width = width;
+    frame->height = height;
+    frame->u1 = (float)x / set->atlas.width;
+    frame->v1 = (float)y / set->atlas.height;
+    frame->u2 = (float)(x + width) / set->atlas.width;
+    frame->v2 = (float)(y + height) / set->atlas.height;
+}
+
+// Builds the collision masks of every frame from the atlas, once, so that animating a sprite only selects one.
+static void iBuildFrameMasks(FrameSet *set)
+{
+    const Image *atlas = &set->atlas;
+    size_t size = 0;
+    for (int i = 0; i < set->frameCount; i++)
+        size += 2 * (size_t)iMaskWords(set->frames[i].width) * set->frames[i].height +
+                iOccupancyWords(set->frames[i].width, set->frames[i].height);
+    set->maskWords = new uint64_t[size];
+
+    uint64_t *mask = set->maskWords;
+    for (int i = 0; i < set->frameCount; i++)
+    {
+        FrameRect *frame = &set->frames[i];
+        int words = iMaskWords(frame->width);
+        frame->collisionMask = mask;
+        frame->mirroredCollisionMask = mask + (size_t)words * frame->height;
+        for (int y = 0; y < frame->height; y++)
+        {
+            uint64_t *row = frame->collisionMask + (size_t)y * words;
+            if (atlas->data && atlas->channels == 4)
+                iPixelKernels.alphaMaskRGBA(atlas->data + ((size_t)(frame->y + y) * atlas->width + frame->x) * 4, frame->width, row);
+            else
+            {
+                memset(row, 0, words * sizeof(uint64_t));
+                for (int x = 0; x < frame->width; x++)
+                {
+                    if (iIsPixelOpaque(atlas, frame->x + x, frame->y + y))
+                        row[x / 64] |= (uint64_t)1 << (x % 64);
+                }
+            }
+            iReverseMaskBits(row, frame->width, frame->mirroredCollisionMask + (size_t)y * words);
+        }
+        frame->occupancyMask = frame->mirroredCollisionMask + (size_t)words * frame->height;
+        iBuildOccupancy(frame->collisionMask, frame->width, frame->height, frame->occupancyMask);
+        mask = frame->occupancyMask + iOccupancyWords(frame->width, frame->height);
+    }
+}
+
+// Copies the pixels of an image into the atlas at (x, y), adding an opaque alpha channel to RGB images.
+static void iCopyFramePixels(const Image *img, Image *atlas, int x, int y)
+{
+    const unsigned char *pixels = img->data;
+    unsigned char *readBack = nullptr;
+    MirrorState mirror = NO_MIRROR;
+    if (!pixels)
+    {
+        // GPU-resident
+        readBack = iAllocPixels((size_t)img->width * img->height * img->channels);
+        iReadTexturePixels(img, readBack);
+        pixels = readBack;
+        mirror = img->mirror;
+    }
+
+    for (int row = 0; row < img->height; row++)
+    {
+        int srcRow = (mirror & VERTICAL) ? img->height - 1 - row : row;
+        const unsigned char *src = pixels + (size_t)srcRow * img->width * img->channels;
+        unsigned char *dst = atlas->data + ((size_t)(y + row) * atlas->width + x) * atlas->channels;
+        if (img->channels == atlas->channels)
+            memcpy(dst, src, (size_t)img->width * img->channels);
+        else
+        {
+            for (int i = 0; i < img->width; i++)
+            {
+                memcpy(dst + i * 4, src + i * 3, 3);
+                dst[i * 4 + 3] = 255;
+            }
+        }
+        if (mirror & HORIZONTAL)
+            iMirrorPixelRow(dst, img->width, atlas->channels);
+    }
+    if (readBack)
+        iFreePixels(readBack);
+}
+
+// Packs copies of `frames` into the atlas of a new frame set, in rows (shelves) of a roughly square atlas.
+// The frames may have different sizes. Returns false if there are no frames to pack.
+bool iMakeFrameSet(FrameSet *set, const Image *frames, int frameCount)
+{
+    set->atlas = {};
+    set->frames = nullptr;
+    set->frameCount = 0;
+    set->refCount = 1;
+    set->maskWords = nullptr;
+
+    long long area = 0;
+    int maxWidth = 0;
+    int channels = 3;
+    for (int i = 0; i < frameCount; i++)
+    {
+        if (!iIsImageLoaded(&frames[i]))
+        {
+            printf("ERROR: Frame %d is not loaded, cannot make a frame set\n", i);
+            return false;
+        }
+        area += (long long)(frames[i].width + FRAME_PADDING) * (frames[i].height + FRAME_PADDING);
+        maxWidth = mmax(maxWidth, frames[i].width + FRAME_PADDING);
+        if (frames[i].channels == 4)
+            channels = 4;
+    }
+    if (frameCount <= 0)
+        return false;
+
+    // First place the frames, then copy them.
+    set->frames = new FrameRect[frameCount];
+    set->frameCount = frameCount;
+    int atlasWidth = mmax(maxWidth, (int)ceil(sqrt((double)area)));
+    atlasWidth = (atlasWidth + 3) & ~3; // Keeps the rows of RGB atlases 4-byte aligned, as GL expects by default.
+    int x = 0, y = 0, shelfHeight = 0;
+    for (int i = 0; i < frameCount; i++)
+    {
+        if (x + frames[i].width > atlasWidth)
+        {
+            x = 0;
+            y += shelfHeight;
+            shelfHeight = 0;
+        }
+        set->frames[i].x = x;
+        set->frames[i].y = y;
+        x += frames[i].width + FRAME_PADDING;
+        shelfHeight = mmax(shelfHeight, frames[i].height + FRAME_PADDING);
+    }
+
+    Image *atlas = &set->atlas;
+    atlas->width = atlasWidth;
+    atlas->height = y + shelfHeight;
+    atlas->channels = channels;
+    atlas->isSVG = false;
+    atlas->dataOwner = PIXELS_POOLED;
+    atlas->mirror = NO_MIRROR;
+    size_t size = (size_t)atlas->width * atlas->height * channels;
+    atlas->data = iAllocPixels(size);
+    memset(atlas->data, 0, size);
+    for (int i = 0; i < frameCount; i++)
+    {
+        iSetFrameRect(set, i, set->frames[i].x, set->frames[i].y, frames[i].width, frames[i].height);
+        iCopyFramePixels(&frames[i], atlas, set->frames[i].x, set->frames[i].y);
+    }
+    iBuildFrameMasks(set);
+    return true;
+}
+
+// Loads a sprite sheet of `rows` x `cols` equally sized frames as a frame set, without copying the frames.
+// The frames are numbered like in iLoadFramesFromSheet2.
+bool iLoadFrameSetFromSheet(FrameSet *set, const char *filename, int rows, int cols, int ignoreColor = -1)
+{
+    set->frames = nullptr;
+    set->frameCount = 0;
+    set->refCount = 1;
+    set->maskWords = nullptr;
+    if (rows <= 0 || cols <= 0 || !iLoadImage2(&set->atlas, filename, ignoreColor))
+        return false;
+
+    int frameWidth = set->atlas.width / cols;
+    int frameHeight = set->atlas.height / rows;
+    set->frameCount = rows * cols;
+    set->frames = new FrameRect[set->frameCount];
+    for (int i = 0; i < set->frameCount; i++)
+        iSetFrameRect(set, i, (i % cols) * frameWidth, (i / cols) * frameHeight, frameWidth, frameHeight);
+    iBuildFrameMasks(set);
+    return true;
+}
+
+// Loads the images of a folder in parallel (see iLoadFramesFromFolderAsync) and packs them into a frame set.
+bool iLoadFrameSetFromFolder(FrameSet *set, const char *folderPath, int ignoreColor = -1, int width = -1, int height = -1,
+                             ResizeFilter filter = RESIZE_SMOOTH)
+{
+    Image *frames = new Image[MAX_FILES];
+    int handles[MAX_FILES];
+    int count = iLoadFramesFromFolderAsync(frames, folderPath, handles, ignoreColor, width, height, filter);
+    bool ok = iWaitImages(handles, count) && iMakeFrameSet(set, frames, count);
+    for (int i = 0; i < count; i++)
+        iFreeImage(&frames[i]);
+    delete[] frames;
+    return ok;
+}
+
+// Returns a new frame set of copies of `frames` (see iMakeFrameSet), or nullptr if there are none.
+// Release it with iReleaseFrameSet.
+FrameSet *iCreateFrameSet(const Image *frames, int frameCount)
+{
+    FrameSet *set = new FrameSet;
+    if (!iMakeFrameSet(set, frames, frameCount))
+    {
+        delete set;
+        return nullptr;
+    }
+    return set;
+}
+
+void iFreeFrameSet(FrameSet *set)
+{
+    iFreeImage(&set->atlas);
+    delete[] set->frames;
+    delete[] set->maskWords;
+    set->frames = nullptr;
+    set->maskWords = nullptr;
+    set->frameCount = 0;
+}
+
+// Adds a reference to a frame set allocated with new, e.g. by iCreateFrameSet. It starts with one.
+FrameSet *iRetainFrameSet(FrameSet *set)
+{
+    set->refCount++;
+    return set;
+}
+
+// Drops a reference to a frame set, and frees it with the last one.
+void iReleaseFrameSet(FrameSet *set)
+{
+    if (set && --set->refCount == 0)
+    {
+        iFreeFrameSet(set);
+        delete set;
+    }
+}
+
+// Copies every frame of a frame set into an image of its own, e.g. to transform the frames and pack them
+// again. Free the images with iFreeImage and the array with delete[].
+Image *iSplitFrameSet(FrameSet *set)
+{
+    Image *atlas = &set->atlas;
+    if (!iRestoreImageData(atlas))
+        return nullptr;
+    Image *frames = new Image[set->frameCount];
+    for (int i = 0; i < set->frameCount; i++)
+    {
+        const FrameRect *rect = &set->frames[i];
+        Image *frame = &frames[i];
+        *frame = {};
+        frame->width = rect->width;
+        frame->height = rect->height;
+        frame->channels = atlas->channels;
+        frame->dataOwner = PIXELS_POOLED;
+        frame->data = iAllocPixels((size_t)rect->width * rect->height * atlas->channels);
+        for (int y = 0; y < rect->height; y++)
+            memcpy(frame->data + (size_t)y * rect->width * atlas->channels,
+                   atlas->data + ((size_t)(rect->y + y) * atlas->width + rect->x) * atlas->channels,
+                   (size_t)rect->width * atlas->channels);
+    }
+    return frames;
+}
+
+// Replaces a frame set with `frames` (see iSplitFrameSet), which it frees. The new atlas is uploaded if the
+// old one was.
+static void iRepackFrameSet(FrameSet *set, Image *frames)
+{
+    int frameCount = set->frameCount;
+    int refCount = set->refCount;
+    bool isUploaded = set->atlas.textureId != 0;
+    iFreeFrameSet(set);
+    iMakeFrameSet(set, frames, frameCount);
+    set->refCount = refCount;
+    if (isUploaded)
+        iWarmTexture(&set->atlas);
+    for (int i = 0; i < frameCount; i++)
+        iFreeImage(&frames[i]);
+    delete[] frames;
+}
+
+static bool iHasFrameSize(const FrameSet *set, int width, int height)
+{
+    for (int i = 0; i < set->frameCount; i++)
+    {
+        if (set->frames[i].width != width || set->frames[i].height != height)
+            return false;
+    }
+    return true;
+}
+
+// Resizes every frame to `width` x `height` and packs them again. Does nothing if they already have that size.
+// Like iScaleFrameSet, it changes the frame set in place, so it is only meant for frame sets that are not shared.
+void iResizeFrameSet(FrameSet *set, int width, int height, ResizeFilter filter = RESIZE_SMOOTH)
+{
+    Image *frames = iHasFrameSize(set, width, height) ? nullptr : iSplitFrameSet(set);
+    if (!frames)
+        return;
+    for (int i = 0; i < set->frameCount; i++)
+        iResizeImage(&frames[i], width, height, filter);
+    iRepackFrameSet(set, frames);
+}
+
+void iScaleFrameSet(FrameSet *set, double scale, ResizeFilter filter = RESIZE_SMOOTH)
+{
+    Image *frames = (scale <= 0.0 || scale == 1.0) ? nullptr : iSplitFrameSet(set);
+    if (!frames)
+        return;
+    for (int i = 0; i < set->frameCount; i++)
+        iScaleImage(&frames[i], scale, filter);
+    iRepackFrameSet(set, frames);
+}
+
+// Draws one frame of a frame set at its own size.
+void iShowFrame(int x, int y, FrameSet *set, int frame, MirrorState mirror = NO_MIRROR)
+{
+    if (!set || frame < 0 || frame >= set->frameCount)
+        return;
+    const FrameRect *rect = &set->frames[frame];
+    if (x + rect->width <= 0 || y + rect->height <= 0 || x >= iScreenWidth || y >= iScreenHeight)
+        return;
+    Image *atlas = &set->atlas;
+    if (atlas->textureId == 0 && !iLoadTexture(atlas))
+        return;
+    if (gpuResidentImages)
+        iReleaseImageData(atlas);
+
+    float tx1 = rect->u1, ty1 = rect->v1;
+    float tx2 = rect->u2, ty2 = rect->v2;
+    if (mirror & HORIZONTAL)
+        sswap(tx1, tx2);
+    if (mirror & VERTICAL)
+        sswap(ty1, ty2);
+
+    glBindTexture(GL_TEXTURE_2D, atlas->textureId);
+    glEnable(GL_TEXTURE_2D);
+    glBegin(GL_QUADS);
+    glTexCoord2f(tx1, ty1);
+    glVertex2i(x, y);
+    glTexCoord2f(tx2, ty1);
+    glVertex2i(x + rect->width, y);
+    glTexCoord2f(tx2, ty2);
+    glVertex2i(x + rect->width, y + rect->height);
+    glTexCoord2f(tx1, ty2);
+    glVertex2i(x, y + rect->height);
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+}
+
+// * Cached images and frame sets
+// Typed wrappers around iResource.h. Loading the same path with the same parameters again returns the same
+// handle; release every handle with iReleaseResource once it is no longer needed.
+void iMeasureImages(Resource *r)
+{
+    Image *images = (Image *)r->data;
+    r->cpuBytes = r->gpuBytes = 0;
+    for (int i = 0; i < r->count; i++)
+    {
+        size_t bytes = (size_t)images[i].width * images[i].height * images[i].channels;
+        if (images[i].data && images[i].dataOwner != PIXELS_MAPPED)
+            r->cpuBytes += bytes;
+        if (images[i].alphaMask)
+            r->cpuBytes += (size_t)iAlphaMaskStride(&images[i]) * images[i].height * sizeof(uint64_t);
+        if (images[i].textureId)
+            r->gpuBytes += bytes;
+    }
+}
+
+void iUnloadImages(Resource *r)
+{
+    Image *images = (Image *)r->data;
+    for (int i = 0; i < r->count; i++)
+        iFreeImage(&images[i]);
+    delete[] images;
+}
+
+bool iLoadImageResource(Resource *r, const char *path, int ignoreColor, int width, int height)
+{
+    Image *img = new Image[1];
+    if (!iWaitImage(iLoadImageAsync(img, path, ignoreColor, width, height)))
+    {
+        delete[] img;
+        return false;
+    }
+    r->data = img;
+    r->count = 1;
+    iMeasureImages(r);
+    return true;
+}
+
+bool iLoadFramesResource(Resource *r, const char *folderPath, int ignoreColor, int width, int height)
+{
+    char *paths[MAX_FILES];
+    int count = iListFrameFiles(folderPath, paths);
+    if (count == 0)
+        return false;
+
+    Image *frames = new Image[count];
+    int handles[MAX_FILES];
+    for (int i = 0; i < count; i++)
+    {
+        handles[i] = iLoadImageAsync(&frames[i], paths[i], ignoreColor, width, height);
+        free(paths[i]);
+    }
+    r->data = frames;
+    r->count = count;
+    if (!iWaitImages(handles, count))
+    {
+        iUnloadImages(r);
+        return false;
+    }
+    iMeasureImages(r);
+    return true;
+}
+
+// Loads the images of `r` again and swaps them in, so pointers to them (e.g. from iGetImage) stay valid.
+bool iReloadImages(Resource *r, const char *path, int ignoreColor, int width, int height)
+{
+    Resource fresh = {};
+    fresh.type = r->type;
+    if (!iResourceTypes[r->type].load(&fresh, path, ignoreColor, width, height))
+        return false;
+    if (fresh.count != r->count)
+    {
+        printf("The number of frames in %s has changed, cannot reload it\n", path);
+        iUnloadImages(&fresh);
+        return false;
+    }
+
+    Image *images = (Image *)r->data;
+    Image *freshImages = (Image *)fresh.data;
+    for (int i = 0; i < r->count; i++)
+    {
+        iFreeImage(&images[i]);
+        images[i] = freshImages[i];
+    }
+    delete[] freshImages;
+    return true;
+}
+
+int iImageResourceType = iRegisterResourceType("image", iLoadImageResource, iUnloadImages, iMeasureImages, iReloadImages);
+int iFramesResourceType = iRegisterResourceType("frames", iLoadFramesResource, iUnloadImages, iMeasureImages, iReloadImages);
+
+// Returns a handle to a cached image, optionally resized, or -1 if it fails to load. See iGetImage.
+int iAcquireImage(const char *filename, int ignoreColor = -1, int width = -1, int height = -1)
+{
+    return iAcquireResource(iImageResourceType, filename, ignoreColor, width, height);
+}
+
+Image *iGetImage(int handle)
+{
+    return (Image *)iResourceData(handle);
+}
+
+// Draws an image by its path. The image is loaded on the first call and then cached like iAcquireImage, and
+// is loaded again when the file changes, so calling this on every frame is cheap.
+void iShowImage2(int x, int y, const char *filename, int ignoreColor)
+{
+    int handle = iAcquireCurrentResource(iImageResourceType, filename, ignoreColor);
+    if (handle < 0)
+    {
+        printf("ERROR: Failed to load image: %s\n", filename);
+        return;
+    }
+    iShowTexture2(x, y, iGetImage(handle), -1, -1, NO_MIRROR);
+    iReleaseResource(handle); // Stays cached while the memory budget allows.
+}
+
+void iShowImage(int x, int y, const char *filename)
+{
+    iShowImage2(x, y, filename);
+}
+
+// Returns a handle to an image if it is cached, -1 otherwise. Never loads anything.
+int iFindImage(const char *filename, int ignoreColor = -1, int width = -1, int height = -1)
+{
+    return iFindResource(iImageResourceType, filename, ignoreColor, width, height);
+}
+
+// Adds an image that was loaded elsewhere (e.g. on a worker thread) to the cache under `filename`, as if
+// iAcquireImage had loaded it. The cache takes over the pixel data and `img` is cleared.
+int iAddImage(const char *filename, Image *img, int ignoreColor = -1, int width = -1, int height = -1)
+{
+    Image *cached = new Image[1];
+    cached[0] = *img;
+    img->data = nullptr;
+    img->textureId = 0;
+    img->dataOwner = PIXELS_MALLOC;
+    img->alphaMask = nullptr;
+    return iAddResource(iImageResourceType, filename, cached, 1, ignoreColor, width, height);
+}
+
+// Returns a handle to the cached frames of a folder (see iLoadFramesFromFolder2), optionally resized,
+// or -1 if the folder has no frames. See iGetFrames and iGetFrameCount.
+int iAcquireFrames(const char *folderPath, int ignoreColor = -1, int width = -1, int height = -1)
+{
+    return iAcquireResource(iFramesResourceType, folderPath, ignoreColor, width, height);
+}
+
+Image *iGetFrames(int handle)
+{
+    return (Image *)iResourceData(handle);
+}
+
+int iGetFrameCount(int handle)
+{
+    return iResourceCount(handle);
+}
+
+// * SVG rasterization
+// Rasterized SVGs are cached on disk in SVG_CACHE_FOLDER, one file per path and scale of the SVG. The file also
+// records the modification time of the SVG, so an SVG is only rasterized again when it changes, and the new
+// pixels replace the old ones. iAcquireSVG also caches them in memory.
+// Rasterizing is split into horizontal bands, which run on the worker threads when called on the main thread.
+#define SVG_CACHE_FOLDER "cache"
+#define SVG_CACHE_MAGIC "ISVG"
+#define SVG_SCALE_UNITS 1000 // Scales are rounded to thousandths in the cache keys.
+#define SVG_BAND_ROWS 64     // Fixed, so that the pixels do not depend on the number of worker threads.
+
+typedef struct
+{
+    char magic[4];
+    int width, height;
+    long long modifiedTime;      // Of the SVG
+    long scale;                  // In SVG_SCALE_UNITS
+    char path[MAX_FILENAME_LEN]; // Of the SVG, in case two paths have the same hash
+} SVGCacheHeader;                // Followed by the RGBA pixels
+
+typedef struct
+{
+    NSVGimage *image;
+    float scale;
+    unsigned char *data; // Of the whole image
+    int width, y, height;
+    bool isQueued; // Run by a worker thread, else by the thread that loads the SVG
+    bool rasterized;
+} SVGBand;
+
+static void iMakeSVGCachePath(char *cachePath, const char *filepath, long scale)
+{
+    snprintf(cachePath, MAX_FILENAME_LEN, SVG_CACHE_FOLDER "/%08x_%ld.svgraw", iHashResourceKey(filepath), scale);
+}
+
+// Reads the pixels cached for the SVG at `filepath` as it was at `modifiedTime`, rasterized at `scale`.
+static bool iReadSVGCache(Image *img, const char *cachePath, const char *filepath, time_t modifiedTime, long scale)
+{
+    FILE *file = fopen(cachePath, "rb");
+    if (!file)
+        return false;
+
+    SVGCacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, SVG_CACHE_MAGIC, 4) == 0 &&
+              header.modifiedTime == (long long)modifiedTime && header.scale == scale && header.width > 0 &&
+              header.height > 0 && header.width <= INT_MAX / 4 / header.height;
+    header.path[MAX_FILENAME_LEN - 1] = '\0';
+    ok = ok && strcmp(header.path, filepath) == 0;
+
+    // The pixels must fill the rest of the file exactly, e.g. not be cut short by a failed write.
+    size_t size = ok ? (size_t)header.width * header.height * 4 : 0;
+    ok = ok && fseek(file, 0, SEEK_END) == 0 && ftell(file) == (long)(sizeof(header) + size) &&
+         fseek(file, sizeof(header), SEEK_SET) == 0;
+    if (ok)
+    {
+        img->data = (unsigned char *)iTrackedMalloc(size);
+        ok = img->data && fread(img->data, 1, size, file) == size;
+        if (ok)
+        {
+            img->width = header.width;
+            img->height = header.height;
+        }
+        else
+        {
+            iTrackedFree(img->data);
+            img->data = nullptr;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+// Replaces the cached pixels of the SVG, so that the pixels of its older versions do not pile up.
+static void iWriteSVGCache(const Image *img, const char *cachePath, const char *filepath, time_t modifiedTime, long scale)
+{
+#ifdef _WIN32
+    _mkdir(SVG_CACHE_FOLDER);
+#else
+    mkdir(SVG_CACHE_FOLDER, 0755);
+#endif
+    FILE *file = fopen(cachePath, "wb");
+    if (!file)
+        return; // The cache is optional.
+
+    SVGCacheHeader header = {};
+    memcpy(header.magic, SVG_CACHE_MAGIC, 4);
+    header.width = img->width;
+    header.height = img->height;
+    header.modifiedTime = modifiedTime;
+    header.scale = scale;
+    snprintf(header.path, sizeof(header.path), "%s", filepath);
+    size_t size = (size_t)img->width * img->height * 4;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(img->data, 1, size, file) == size;
+    fclose(file);
+    if (!ok)
+        remove(cachePath);
+}
+
+void iRunSVGBand(void *arg)
+{
+    SVGBand *band = (SVGBand *)arg;
+    NSVGrasterizer *rast = nsvgCreateRasterizer();
+    band->rasterized = rast != nullptr;
+    if (!rast)
+        return;
+    // Shifted up, so that the band's first row is the bitmap's first row.
+    nsvgRasterize(rast, band->image, 0, (float)-band->y, band->scale, band->data + (size_t)band->y * band->width * 4,
+                  band->width, band->height, band->width * 4);
+    nsvgDeleteRasterizer(rast);
+}
+
+// Rasterizes an SVG at `scale` into a new image, from the disk cache if possible.
+bool iLoadSVG(Image *img, const char *filepath, double scale)
+{
+    img->data = nullptr;
+    img->isSVG = true; // Mark as SVG image
+    img->channels = 4; // RGBA
+    img->dataOwner = PIXELS_MALLOC;
+    img->textureId = 0;
+    img->alphaMask = nullptr;
+    img->mirror = NO_MIRROR;
+
+    struct stat st;
+    if (stat(filepath, &st) != 0)
+    {
+        fprintf(stderr, "Could not open SVG file: %s\n", filepath);
+        return false;
+    }
+    char cachePath[MAX_FILENAME_LEN];
+    long scaleUnits = lround(scale * SVG_SCALE_UNITS);
+    iMakeSVGCachePath(cachePath, filepath, scaleUnits);
+    if (iReadSVGCache(img, cachePath, filepath, st.st_mtime, scaleUnits))
+        return true;
+
+    // Load SVG
+    NSVGimage *image = nsvgParseFromFile(filepath, "px", 96.0f);
+    if (!image)
+    {
+        fprintf(stderr, "Could not open SVG file: %s\n", filepath);
+        return false;
+    }
+
+    int outW = (int)((int)image->width * scale);
+    int outH = (int)((int)image->height * scale);
+    img->data = (unsigned char *)iTrackedMalloc((size_t)outW * outH * 4);
+    if (!img->data)
+    {
+        fprintf(stderr, "Failed to allocate image buffer\n");
+        nsvgDelete(image);
+        return false;
     }
 
-    char *filenames[MAX_FILES];
-    int count = 0;
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL && count < MAX_FILES)
+    // A job may not wait for other jobs, so SVGs loaded by jobs rasterize their bands one after another.
+    int bandCount = mmax(1, (outH + SVG_BAND_ROWS - 1) / SVG_BAND_ROWS);
+    SVGBand *bands = new SVGBand[bandCount];
+    int *handles = new int[bandCount];
+    for (int i = 0; i < bandCount; i++)
     {
-        const char *name = entry->d_name;
-
-        // Skip "." and ".."
-        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
-            continue;
-
-        // Build full path to check if it's a directory
-        char fullPath[MAX_FILENAME_LEN];
-        snprintf(fullPath, sizeof(fullPath), "%s/%s", folderPath, name);
+        SVGBand *band = &bands[i];
+        band->image = image;
+        band->scale = (float)scale;
+        band->data = img->data;
+        band->width = outW;
+        band->y = i * SVG_BAND_ROWS;
+        band->height = mmin(SVG_BAND_ROWS, outH - band->y);
+        band->isQueued = i > 0 && !iIsWorkerThread;
+        handles[i] = band->isQueued ? iSubmitJob(iRunSVGBand, band) : -1;
+    }
+    bool rasterized = true;
+    for (int i = 0; i < bandCount; i++)
+    {
+        if (bands[i].isQueued)
+            iWaitJob(handles[i]);
+        else
+            iRunSVGBand(&bands[i]);
+        rasterized = rasterized && bands[i].rasterized;
+    }
+    delete[] bands;
+    delete[] handles;
+    nsvgDelete(image);
 
-        struct stat st;
-        if (stat(fullPath, &st) == 0 && S_ISDIR(st.st_mode))
-            continue;
+    if (!rasterized)
+    {
+        fprintf(stderr, "Failed to create rasterizer\n");
+        iTrackedFree(img->data);
+        img->data = nullptr;
+        return false;
+    }
+    img->width = outW;
+    img->height = outH;
+    iWriteSVGCache(img, cachePath, filepath, st.st_mtime, scaleUnits);
+    return true;
+}
 
-        // Optionally filter image files (uncomment if needed)
-        filenames[count] = strdup(name);
-        if (filenames[count] != NULL)
-            count++;
+bool iLoadSVGResource(Resource *r, const char *path, int, int scale, int)
+{
+    Image *img = new Image[1];
+    if (!iLoadSVG(img, path, (double)scale / SVG_SCALE_UNITS))
+    {
+        delete[] img;
+        return false;
     }
-    closedir(dir);
+    r->data = img;
+    r->count = 1;
+    iMeasureImages(r);
+    return true;
+}
 
-    qsort(filenames, count, sizeof(char *), compareFilenames);
+// The scale of the SVG is passed as the width of the resource.
+int iSVGResourceType = iRegisterResourceType("svg", iLoadSVGResource, iUnloadImages, iMeasureImages, iReloadImages);
 
-    // Load images in sorted order
-    for (int i = 0; i < count; ++i)
+// Returns a handle to a cached image of an SVG rasterized at `scale`, or -1 if it fails to load. See iGetImage.
+// Rasterizes the SVG again if the file changed since.
+int iAcquireSVG(const char *filepath, double scale = 1.0)
+{
+    return iAcquireCurrentResource(iSVGResourceType, filepath, -1, (int)lround(scale * SVG_SCALE_UNITS));
+}
+
+void iShowSVG2(double x, double y, const char *filepath, double scale = 1.0, MirrorState mirror = NO_MIRROR)
+{
+    int handle = iAcquireSVG(filepath, scale);
+    if (handle < 0)
     {
-        char fullPath[MAX_FILENAME_LEN];
-        snprintf(fullPath, sizeof(fullPath), "%s/%s", folderPath, filenames[i]);
-        iLoadImage2(&frames[i], fullPath, ignoreColor);
-        free(filenames[i]); // free allocated memory
+        printf("ERROR: Failed to load svg: %s\n", filepath);
+        return;
     }
+    Image *img = iGetImage(handle);
+    iShowTexture2(x, y, img, img->width, img->height, mirror);
+    iReleaseResource(handle); // Stays cached while the memory budget allows.
 }
 
-void iLoadFramesFromFolder(Image *frames, const char *folderPath)
+void iShowSVG(double x, double y, const char *filepath)
 {
-    iLoadFramesFromFolder2(frames, folderPath);
+    iShowSVG2(x, y, filepath);
 }
 
 void iInitSprite(Sprite *s)
@@ -1163,7 +2834,7 @@ void iInitSprite(Sprite *s)
 
     // Assign the pre-loaded frames to the sprite
     s->currentFrame = -1;
-    s->frames = nullptr;       // Directly assign frames
+    s->frameSet = nullptr;
     s->totalFrames = -1;       // Set the number of frames
     s->scale = 1.0f;           // Initialize scale
     s->flipHorizontal = false; // Initialize flip state
@@ -1180,10 +2851,13 @@ void deepCopyImage(Image src, Image *dst)
     dst->height = src.height;
     dst->channels = src.channels;
     dst->isSVG = src.isSVG; // Copy SVG flag
-    dst->textureId = 0;     // Copy texture ID
+    dst->dataOwner = PIXELS_MALLOC;
+    dst->textureId = 0; // Copy texture ID
+    dst->alphaMask = nullptr;
+    dst->mirror = NO_MIRROR;
 
     // Allocate memory for the image data in the destination
-    dst->data = (unsigned char *)malloc(src.width * src.height * src.channels);
+    dst->data = (unsigned char *)iTrackedMalloc(src.width * src.height * src.channels);
     if (dst->data == NULL)
     {
         // Handle memory allocation failure
@@ -1192,21 +2866,56 @@ void deepCopyImage(Image src, Image *dst)
     }
 
     // Copy the image data byte-by-byte
-    memcpy(dst->data, src.data, src.width * src.height * src.channels);
+    if (src.data)
+        memcpy(dst->data, src.data, src.width * src.height * src.channels);
+    else if (src.textureId)
+    {
+        // GPU-resident
+        iReadTexturePixels(&src, dst->data);
+        if (src.mirror & HORIZONTAL)
+            iMirrorImage(dst, HORIZONTAL);
+        if (src.mirror & VERTICAL)
+            iMirrorImage(dst, VERTICAL);
+    }
     // iAllocateTexture(dst); // Set the texture ID for the destination image
 }
 
+// Gives the sprite a copy of its frame set before the frames are transformed, if other sprites share it.
+// Returns false if the copy cannot be made, so the shared frames must be left alone.
+static bool iUnshareSpriteFrameSet(Sprite *s)
+{
+    if (!s->frameSet || s->frameSet->refCount == 1)
+        return true;
+    int frameCount = s->frameSet->frameCount;
+    Image *frames = iSplitFrameSet(s->frameSet);
+    FrameSet *copy = nullptr;
+    if (frames)
+    {
+        copy = iCreateFrameSet(frames, frameCount);
+        for (int i = 0; i < frameCount; i++)
+            iFreeImage(&frames[i]);
+        delete[] frames;
+    }
+    if (!copy)
+    {
+        printf("ERROR: Cannot copy the shared frames of a sprite\n");
+        return false;
+    }
+    if (s->frameSet->atlas.textureId)
+        iWarmTexture(&copy->atlas);
+    iReleaseFrameSet(s->frameSet);
+    s->frameSet = copy;
+    return true;
+}
+
 void iScaleSprite(Sprite *s, double scale)
 {
-    if (!s || scale <= 0.0f)
+    if (!s || scale <= 0.0f || !iUnshareSpriteFrameSet(s))
         return;
 
     s->scale *= scale;
-    for (int i = 0; i < s->totalFrames; ++i)
-    {
-        Image *frame = &s->frames[i];
-        iScaleImage(frame, scale);
-    }
+    if (s->frameSet)
+        iScaleFrameSet(s->frameSet, scale);
 
     iUpdateCollisionMask(s);
 }
@@ -1214,64 +2923,42 @@ void iScaleSprite(Sprite *s, double scale)
 int iGetVisiblePixelsCount(Sprite *s)
 {
     // Use sprite collision mask to count visible pixels
-    if (!s || !s->collisionMask || !s->frames)
+    if (!s || !s->collisionMask || !s->frameSet)
         return 0;
 
-    Image *frame = &s->frames[s->currentFrame];
-    int width = frame->width;
-    int height = frame->height;
+    const FrameRect *frame = &s->frameSet->frames[s->currentFrame];
+    int wordCount = iMaskWords(frame->width) * frame->height; // Bits past the width are 0.
     int visibleCount = 0;
-    for (int y = 0; y < height; ++y)
-    {
-        for (int x = 0; x < width; ++x)
-        {
-            int index = y * width + x;
-            if (s->collisionMask[index] > 0) // Assuming non-zero means visible
-            {
-                visibleCount++;
-            }
-        }
-    }
-
+    for (int i = 0; i < wordCount; i++)
+        visibleCount += __builtin_popcountll(s->collisionMask[i]);
     return visibleCount;
 }
 
-void iChangeSpriteFrames(Sprite *s, const Image *frames, int totalFrames)
+// Makes the sprite show the frames of a frame set, which it shares with its other users, from the first frame.
+// The flips of the sprite are applied when it is drawn, and the frames are drawn at their own size.
+void iSetSpriteFrameSet(Sprite *s, FrameSet *set)
 {
-    if (s->frames != nullptr)
-    {
-        for (int i = 0; i < s->totalFrames; ++i)
-        {
-            iFreeImage(&s->frames[i]);
-        }
-        delete[] s->frames;
-    }
-
-    s->frames = new Image[totalFrames];
-
-    for (int i = 0; i < totalFrames; ++i)
-    {
-        // printf("PASSED %d\n", i);
-        deepCopyImage(frames[i], &s->frames[i]);
-    }
-
+    if (set)
+        iRetainFrameSet(set);
+    iReleaseFrameSet(s->frameSet);
+    s->frameSet = set;
     s->currentFrame = 0;
-    s->totalFrames = totalFrames;
+    s->totalFrames = set ? set->frameCount : -1;
     s->collisionMask = nullptr;
-
-    // Apply transformations to each frame
-    for (int i = 0; i < s->totalFrames; ++i)
-    {
-        Image *frame = &s->frames[i];
-        iScaleImage(frame, s->scale);
-        if (s->flipHorizontal)
-            iMirrorImage(frame, HORIZONTAL);
-        if (s->flipVertical)
-            iMirrorImage(frame, VERTICAL);
-    }
     iUpdateCollisionMask(s);
 }
 
+// Packs copies of `frames` into a new frame set for the sprite (see iCreateFrameSet), scaled like the sprite.
+void iChangeSpriteFrames(Sprite *s, const Image *frames, int totalFrames)
+{
+    FrameSet *set = iCreateFrameSet(frames, totalFrames);
+    if (!set)
+        return;
+    iScaleFrameSet(set, s->scale);
+    iSetSpriteFrameSet(s, set);
+    iReleaseFrameSet(set);
+}
+
 void iSetSpritePosition(Sprite *s, int x, int y)
 {
     s->x = x;
@@ -1328,7 +3015,7 @@ void iUnScale()
 
 void iShowSprite(const Sprite *s)
 {
-    if (!s || !s->frames)
+    if (!s || !s->frameSet)
     {
         return;
     }
@@ -1336,16 +3023,18 @@ void iShowSprite(const Sprite *s)
         s->rotationCenterX,
         s->rotationCenterY,
         s->rotation);
-    iShowTexture2(s->x, s->y, &s->frames[s->currentFrame]);
+    int mirror = (s->flipHorizontal ? HORIZONTAL : NO_MIRROR) | (s->flipVertical ? VERTICAL : NO_MIRROR);
+    iShowFrame(s->x, s->y, s->frameSet, s->currentFrame, (MirrorState)mirror);
     iUnRotate();
 }
 
-void iResizeSprite(Sprite *s, int width, int height)
+void iResizeSprite(Sprite *s, int width, int height, ResizeFilter filter = RESIZE_SMOOTH)
 {
-    for (int i = 0; i < s->totalFrames; ++i)
+    if (s->frameSet && !iHasFrameSize(s->frameSet, width, height))
     {
-        Image *frame = &s->frames[i];
-        iResizeImage(frame, width, height);
+        if (!iUnshareSpriteFrameSet(s))
+            return;
+        iResizeFrameSet(s->frameSet, width, height, filter);
     }
     iUpdateCollisionMask(s);
 }
@@ -1360,35 +3049,25 @@ void iResizeSprite(Sprite *s, int width, int height)
 //     iUpdateCollisionMask(s);
 // }
 
+// Only flips the texture coordinates of the sprite, its frame set is left alone.
 void iMirrorSprite(Sprite *s, MirrorState state)
 {
-    if (state == HORIZONTAL)
+    if (state & HORIZONTAL)
     {
         s->flipHorizontal = !s->flipHorizontal;
     }
-    else if (state == VERTICAL)
+    if (state & VERTICAL)
     {
         s->flipVertical = !s->flipVertical;
     }
-    for (int i = 0; i < s->totalFrames; ++i)
-    {
-        Image *frame = &s->frames[i];
-        iMirrorImage(frame, state);
-    }
     iUpdateCollisionMask(s);
 }
 
 void iFreeSprite(Sprite *s)
 {
-    for (int i = 0; i < s->totalFrames; ++i)
-    {
-        iFreeImage(&s->frames[i]);
-    }
-    delete[] s->frames;
-    if (s->collisionMask != nullptr)
-    {
-        delete[] s->collisionMask;
-    }
+    iReleaseFrameSet(s->frameSet);
+    s->frameSet = nullptr;
+    s->collisionMask = nullptr;
 }
 
 void iGetPixelColor(int cursorX, int cursorY, int rgb[])
@@ -1404,6 +3083,492 @@ void iGetPixelColor(int cursorX, int cursorY, int rgb[])
     // printf("%d %d %d\n",pixel[0],pixel[1],pixel[2]);
 }
 
+// * Frame capture
+// Screenshots and recordings of the window that do not stall the frame, unlike a glReadPixels into memory. Each
+// captured frame is read into one of a ring of pixel buffer objects, which the GPU fills while the next frames are
+// drawn, and is only mapped when its slot comes around again, CAPTURE_PBO_COUNT frames later. The frame then pays
+// for a copy, and a writer thread encodes and writes the pixels. If OpenGL has no pixel buffer objects, the frame
+// is read synchronously instead.
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define stbi__paeth stbiw__paeth // Also defined by stb_image.h
+#include "stb_image_write.h"
+#undef stbi__paeth
+
+#define CAPTURE_PBO_COUNT 3
+#define CAPTURE_BUFFER_COUNT 8 // Frames that may wait for the writer thread. Frames are dropped while all of them wait.
+#define MAX_CAPTURE_PATH_LEN 160
+#define MAX_RECORDING_FOLDER_LEN (MAX_CAPTURE_PATH_LEN - 32) // Leaves room for the frame file names
+#define MAX_CAPTURE_TARGETS 2                                 // A recorded frame may also be a screenshot
+#define CAPTURE_FOLDER "captures"
+
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#define GL_STREAM_READ 0x88E1
+#define GL_READ_ONLY 0x88B8
+#endif
+
+// OpenGL 1.5 functions, which opengl32.dll does not export. Loaded by iStartCapture.
+typedef void(APIENTRY *iGenBuffersProc)(GLsizei n, GLuint *buffers);
+typedef void(APIENTRY *iBindBufferProc)(GLenum target, GLuint buffer);
+typedef void(APIENTRY *iBufferDataProc)(GLenum target, ptrdiff_t size, const void *data, GLenum usage);
+typedef void *(APIENTRY *iMapBufferProc)(GLenum target, GLenum access);
+typedef GLboolean(APIENTRY *iUnmapBufferProc)(GLenum target);
+iGenBuffersProc iGlGenBuffers = nullptr;
+iBindBufferProc iGlBindBuffer = nullptr;
+iBufferDataProc iGlBufferData = nullptr;
+iMapBufferProc iGlMapBuffer = nullptr;
+iUnmapBufferProc iGlUnmapBuffer = nullptr;
+
+enum CaptureFormat
+{
+    CAPTURE_PNG,
+    CAPTURE_RAW // RGBA bytes, top row first. Fast enough to record every frame.
+};
+
+enum CaptureBufferState
+{
+    CAPTURE_BUFFER_FREE,
+    CAPTURE_BUFFER_FILLING, // Taken by the main thread
+    CAPTURE_BUFFER_QUEUED   // Waiting for or being written by the writer thread
+};
+
+typedef struct
+{
+    unsigned char *pixels; // RGBA, bottom row first, as read from the window
+    size_t capacity;
+    int width, height;
+    int format; // CaptureFormat
+    char path[MAX_CAPTURE_PATH_LEN];
+    int state; // CaptureBufferState, guarded by iCaptureMutex
+} CaptureBuffer;
+
+// A file a captured frame is written to.
+typedef struct
+{
+    int format;           // CaptureFormat
+    bool isRecordedFrame; // `path` is the recording folder, and the file is named once the frame is queued
+    char path[MAX_CAPTURE_PATH_LEN];
+} CaptureTarget;
+
+typedef struct
+{
+    GLuint pbo;
+    size_t capacity;
+    int width, height;
+    CaptureTarget targets[MAX_CAPTURE_TARGETS];
+    int targetCount; // 0 unless the slot holds a frame that has not been handed to the writer yet
+} CaptureSlot;
+
+CaptureSlot iCaptureSlots[CAPTURE_PBO_COUNT];
+int iCaptureSlotHead = 0;
+CaptureBuffer iCaptureBuffers[CAPTURE_BUFFER_COUNT];
+int iCaptureQueue[CAPTURE_BUFFER_COUNT]; // Ring buffer of queued buffer indices
+int iCaptureQueueHead = 0, iCaptureQueueCount = 0;
+iMutex iCaptureMutex;
+iSemaphore iCaptureQueued; // Posted once per queued buffer, waited on by the writer thread
+bool iCaptureStarted = false;
+bool iHasPixelBuffers = false;
+
+char iScreenshotPath[MAX_CAPTURE_PATH_LEN]; // Empty unless iCaptureFrame was called since the last frame
+bool iIsRecording = false;
+char iRecordingFolder[MAX_RECORDING_FOLDER_LEN];
+int iRecordingFormat = CAPTURE_RAW;
+int iRecordedFrames = 0;
+int iDroppedCaptureFrames = 0;
+
+// Creates a folder and its missing parents.
+static void iMakeFolders(const char *path)
+{
+    char folder[MAX_CAPTURE_PATH_LEN];
+    snprintf(folder, sizeof(folder), "%s", path);
+    for (char *p = folder + 1;; p++)
+    {
+        if (*p != '/' && *p != '\0')
+            continue;
+        char separator = *p;
+        *p = '\0';
+#ifdef _WIN32
+        _mkdir(folder);
+#else
+        mkdir(folder, 0755);
+#endif
+        *p = separator;
+        if (separator == '\0')
+            break;
+    }
+}
+
+static void iWriteCapture(CaptureBuffer *buffer)
+{
+    // The alpha of the window is whatever was drawn last, so it is made opaque.
+    size_t pixelCount = (size_t)buffer->width * buffer->height;
+    for (size_t i = 0; i < pixelCount; i++)
+        buffer->pixels[i * 4 + 3] = 255;
+
+    int stride = buffer->width * 4;
+    const unsigned char *topRow = buffer->pixels + (size_t)(buffer->height - 1) * stride;
+    bool ok;
+    if (buffer->format == CAPTURE_PNG)
+        ok = stbi_write_png(buffer->path, buffer->width, buffer->height, 4, topRow, -stride) != 0;
+    else
+    {
+        FILE *file = fopen(buffer->path, "wb");
+        ok = file != nullptr;
+        for (int y = 0; ok && y < buffer->height; y++)
+            ok = fwrite(topRow - (size_t)y * stride, 1, stride, file) == (size_t)stride;
+        if (file)
+            fclose(file);
+    }
+    if (!ok)
+        printf("ERROR: Failed to write %s\n", buffer->path);
+}
+
+#ifdef _WIN32
+DWORD WINAPI iCaptureWriterMain(LPVOID)
+#else
+void *iCaptureWriterMain(void *)
+#endif
+{
+    iIsWorkerThread = true;
+    while (true)
+    {
+        iSemaphoreWait(&iCaptureQueued);
+        iMutexLock(&iCaptureMutex);
+        CaptureBuffer *buffer = &iCaptureBuffers[iCaptureQueue[iCaptureQueueHead]];
+        iCaptureQueueHead = (iCaptureQueueHead + 1) % CAPTURE_BUFFER_COUNT;
+        iCaptureQueueCount--;
+        iMutexUnlock(&iCaptureMutex);
+
+        iWriteCapture(buffer);
+
+        iMutexLock(&iCaptureMutex);
+        buffer->state = CAPTURE_BUFFER_FREE;
+        iMutexUnlock(&iCaptureMutex);
+    }
+    return 0;
+}
+
+// Loads the pixel buffer functions and starts the writer thread. Called by the first capture, as it needs the
+// GL context of the window.
+static void iStartCapture()
+{
+    if (iCaptureStarted)
+        return;
+    iCaptureStarted = true;
+    iMutexInit(&iCaptureMutex);
+    iSemaphoreInit(&iCaptureQueued);
+
+    iGlGenBuffers = (iGenBuffersProc)glutGetProcAddress("glGenBuffers");
+    iGlBindBuffer = (iBindBufferProc)glutGetProcAddress("glBindBuffer");
+    iGlBufferData = (iBufferDataProc)glutGetProcAddress("glBufferData");
+    iGlMapBuffer = (iMapBufferProc)glutGetProcAddress("glMapBuffer");
+    iGlUnmapBuffer = (iUnmapBufferProc)glutGetProcAddress("glUnmapBuffer");
+    iHasPixelBuffers = iGlGenBuffers && iGlBindBuffer && iGlBufferData && iGlMapBuffer && iGlUnmapBuffer;
+    if (iHasPixelBuffers)
+    {
+        for (int i = 0; i < CAPTURE_PBO_COUNT; i++)
+            iGlGenBuffers(1, &iCaptureSlots[i].pbo);
+    }
+    else
+        printf("Pixel buffer objects are not available, frames are captured synchronously\n");
+
+#ifdef _WIN32
+    HANDLE thread = CreateThread(NULL, 0, iCaptureWriterMain, NULL, 0, NULL);
+    if (thread != NULL)
+        CloseHandle(thread);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, iCaptureWriterMain, NULL) == 0)
+        pthread_detach(thread);
+#endif
+}
+
+// A free buffer with room for a frame, or nullptr if every buffer waits for the writer thread.
+static CaptureBuffer *iTakeCaptureBuffer(int width, int height, int format, const char *path)
+{
+    CaptureBuffer *buffer = nullptr;
+    iMutexLock(&iCaptureMutex);
+    for (int i = 0; i < CAPTURE_BUFFER_COUNT && !buffer; i++)
+    {
+        if (iCaptureBuffers[i].state == CAPTURE_BUFFER_FREE)
+        {
+            buffer = &iCaptureBuffers[i];
+            buffer->state = CAPTURE_BUFFER_FILLING;
+        }
+    }
+    iMutexUnlock(&iCaptureMutex);
+    if (!buffer)
+    {
+        iDroppedCaptureFrames++;
+        return nullptr;
+    }
+
+    size_t size = (size_t)width * height * 4;
+    if (buffer->capacity < size)
+    {
+        iTrackedFree(buffer->pixels);
+        buffer->pixels = (unsigned char *)iTrackedMalloc(size);
+        buffer->capacity = size;
+    }
+    buffer->width = width;
+    buffer->height = height;
+    buffer->format = format;
+    snprintf(buffer->path, MAX_CAPTURE_PATH_LEN, "%s", path);
+    return buffer;
+}
+
+static void iQueueCaptureBuffer(CaptureBuffer *buffer)
+{
+    iMutexLock(&iCaptureMutex);
+    buffer->state = CAPTURE_BUFFER_QUEUED;
+    iCaptureQueue[(iCaptureQueueHead + iCaptureQueueCount) % CAPTURE_BUFFER_COUNT] = (int)(buffer - iCaptureBuffers);
+    iCaptureQueueCount++;
+    iMutexUnlock(&iCaptureMutex);
+    iSemaphorePost(&iCaptureQueued);
+}
+
+// Takes a buffer for each target. buffers[i] is nullptr if none was free for targets[i], which drops the frame for
+// it. Returns the number of buffers taken.
+static int iTakeCaptureBuffers(const CaptureTarget *targets, int targetCount, int width, int height, CaptureBuffer **buffers)
+{
+    int bufferCount = 0;
+    for (int i = 0; i < targetCount; i++)
+    {
+        buffers[i] = iTakeCaptureBuffer(width, height, targets[i].format, targets[i].path);
+        if (buffers[i])
+            bufferCount++;
+    }
+    return bufferCount;
+}
+
+// Hands a filled buffer to the writer thread. Recorded frames are numbered here, so that iRecordedFrames only counts
+// the frames that are written, and their files are numbered without gaps.
+static void iQueueCaptureTarget(CaptureBuffer *buffer, const CaptureTarget *target)
+{
+    if (target->isRecordedFrame)
+        snprintf(buffer->path, MAX_CAPTURE_PATH_LEN, "%.*s/frame_%06d.%s", MAX_RECORDING_FOLDER_LEN - 1, target->path,
+                 iRecordedFrames++, target->format == CAPTURE_PNG ? "png" : "rgba");
+    iQueueCaptureBuffer(buffer);
+}
+
+// Hands the frame of a slot to the writer thread, once per target. Maps the pixel buffer, which waits for the GPU
+// if it has not finished reading the frame yet.
+static void iFinishCaptureSlot(CaptureSlot *slot)
+{
+    CaptureBuffer *buffers[MAX_CAPTURE_TARGETS];
+    int targetCount = slot->targetCount;
+    slot->targetCount = 0;
+    if (iTakeCaptureBuffers(slot->targets, targetCount, slot->width, slot->height, buffers) == 0)
+        return;
+    iGlBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    const void *pixels = iGlMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels)
+    {
+        for (int i = 0; i < targetCount; i++)
+        {
+            if (buffers[i])
+                memcpy(buffers[i]->pixels, pixels, (size_t)slot->width * slot->height * 4);
+        }
+        iGlUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    iGlBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    for (int i = 0; i < targetCount; i++)
+    {
+        if (!buffers[i])
+            continue;
+        if (pixels)
+            iQueueCaptureTarget(buffers[i], &slot->targets[i]);
+        else
+        {
+            printf("ERROR: Failed to map the pixel buffer of %s\n", buffers[i]->path);
+            buffers[i]->state = CAPTURE_BUFFER_FREE; // Not queued, so the writer thread does not know it.
+            iDroppedCaptureFrames++;
+        }
+    }
+}
+
+// Starts reading the drawn frame of the window into the slot at the head of the ring, to be written to every target.
+static void iReadCaptureFrame(const CaptureTarget *targets, int targetCount)
+{
+    int width = iScreenWidth, height = iScreenHeight;
+    size_t size = (size_t)width * height * 4;
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    if (!iHasPixelBuffers)
+    {
+        CaptureBuffer *buffers[MAX_CAPTURE_TARGETS];
+        if (iTakeCaptureBuffers(targets, targetCount, width, height, buffers) == 0)
+            return;
+        const unsigned char *pixels = nullptr;
+        for (int i = 0; i < targetCount; i++)
+        {
+            if (!buffers[i])
+                continue;
+            if (pixels)
+                memcpy(buffers[i]->pixels, pixels, size);
+            else
+            {
+                glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, buffers[i]->pixels);
+                pixels = buffers[i]->pixels;
+            }
+        }
+        for (int i = 0; i < targetCount; i++)
+        {
+            if (buffers[i])
+                iQueueCaptureTarget(buffers[i], &targets[i]);
+        }
+        return;
+    }
+
+    CaptureSlot *slot = &iCaptureSlots[iCaptureSlotHead];
+    iGlBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    if (slot->capacity < size)
+    {
+        iGlBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        slot->capacity = size;
+    }
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0); // Returns before the pixels are copied
+    iGlBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot->width = width;
+    slot->height = height;
+    memcpy(slot->targets, targets, sizeof(CaptureTarget) * targetCount);
+    slot->targetCount = targetCount;
+}
+
+// Called after every drawn frame, before it is presented.
+static void iUpdateCapture()
+{
+    if (!iScreenshotPath[0] && !iIsRecording && !iCaptureStarted)
+        return;
+    iStartCapture();
+
+    // The slot was read CAPTURE_PBO_COUNT frames ago, so the GPU is most likely done with it.
+    CaptureSlot *slot = &iCaptureSlots[iCaptureSlotHead];
+    if (slot->targetCount > 0)
+        iFinishCaptureSlot(slot);
+
+    // A screenshot taken while recording is a copy of the recorded frame.
+    CaptureTarget targets[MAX_CAPTURE_TARGETS];
+    int targetCount = 0;
+    if (iIsRecording)
+    {
+        CaptureTarget *target = &targets[targetCount++];
+        target->format = iRecordingFormat;
+        target->isRecordedFrame = true;
+        snprintf(target->path, MAX_CAPTURE_PATH_LEN, "%s", iRecordingFolder);
+    }
+    if (iScreenshotPath[0])
+    {
+        CaptureTarget *target = &targets[targetCount++];
+        target->format = CAPTURE_PNG;
+        target->isRecordedFrame = false;
+        snprintf(target->path, MAX_CAPTURE_PATH_LEN, "%s", iScreenshotPath);
+        iScreenshotPath[0] = '\0';
+    }
+    if (targetCount > 0)
+        iReadCaptureFrame(targets, targetCount);
+    iCaptureSlotHead = (iCaptureSlotHead + 1) % CAPTURE_PBO_COUNT;
+}
+
+// Hands the frames of every slot to the writer thread, oldest first. Waits for the GPU to finish reading them.
+static void iFinishCaptureSlots()
+{
+    if (!iCaptureStarted)
+        return;
+    for (int i = 0; i < CAPTURE_PBO_COUNT; i++)
+    {
+        CaptureSlot *slot = &iCaptureSlots[(iCaptureSlotHead + i) % CAPTURE_PBO_COUNT];
+        if (slot->targetCount > 0)
+            iFinishCaptureSlot(slot);
+    }
+}
+
+// Saves the next drawn frame to a PNG file. With no path, the file is named after the current time and saved
+// in CAPTURE_FOLDER. The file is written a few frames later, on the writer thread.
+void iCaptureFrame(const char *filePath = nullptr)
+{
+    if (filePath)
+    {
+        snprintf(iScreenshotPath, MAX_CAPTURE_PATH_LEN, "%s", filePath);
+        return;
+    }
+    static int screenshotCount = 0;
+    char name[64];
+    time_t now = time(NULL);
+    strftime(name, sizeof(name), "screenshot_%Y%m%d_%H%M%S", localtime(&now));
+    iMakeFolders(CAPTURE_FOLDER);
+    snprintf(iScreenshotPath, MAX_CAPTURE_PATH_LEN, CAPTURE_FOLDER "/%s_%d.png", name, screenshotCount++);
+}
+
+// Saves every drawn frame to `folder` (created if needed) as frame_000000.png, frame_000001.png, ... or .rgba,
+// until iStopRecording. With no folder, a folder named after the current time is made in CAPTURE_FOLDER.
+// PNG encoding may not keep up with the frame rate; frames are then dropped and counted, and the files that are
+// written are numbered without gaps.
+// The raw frames can be made into a video with e.g.
+//   cat folder/*.rgba | ffmpeg -f rawvideo -pixel_format rgba -video_size WxH -framerate 60 -i - video.mp4
+// Returns false if the folder path is longer than MAX_RECORDING_FOLDER_LEN - 1.
+bool iStartRecording(const char *folder = nullptr, CaptureFormat format = CAPTURE_RAW)
+{
+    if (folder && strlen(folder) >= MAX_RECORDING_FOLDER_LEN)
+    {
+        printf("ERROR: Recording folder path is too long: %s\n", folder);
+        return false;
+    }
+    if (folder)
+        snprintf(iRecordingFolder, MAX_RECORDING_FOLDER_LEN, "%s", folder);
+    else
+    {
+        char name[64];
+        time_t now = time(NULL);
+        strftime(name, sizeof(name), "recording_%Y%m%d_%H%M%S", localtime(&now));
+        snprintf(iRecordingFolder, MAX_RECORDING_FOLDER_LEN, CAPTURE_FOLDER "/%s", name);
+    }
+    iMakeFolders(iRecordingFolder);
+    iRecordingFormat = format;
+    iRecordedFrames = 0;
+    iDroppedCaptureFrames = 0;
+    iIsRecording = true;
+    printf("Recording frames to %s\n", iRecordingFolder);
+    return true;
+}
+
+void iStopRecording()
+{
+    if (!iIsRecording)
+        return;
+    iIsRecording = false;
+    iFinishCaptureSlots(); // The last frames are still being read, and only count once they are queued.
+    printf("Recorded %d frames to %s, %d dropped\n", iRecordedFrames, iRecordingFolder, iDroppedCaptureFrames);
+}
+
+bool iIsRecordingFrames()
+{
+    return iIsRecording;
+}
+
+// Hands every pending frame to the writer thread and waits until they are written, e.g. before exiting.
+// Stalls the GPU, so it should not be called while recording.
+void iFinishCaptures()
+{
+    if (!iCaptureStarted)
+        return;
+    iFinishCaptureSlots();
+    while (true)
+    {
+        iMutexLock(&iCaptureMutex);
+        bool isWriting = iCaptureQueueCount > 0;
+        for (int i = 0; i < CAPTURE_BUFFER_COUNT; i++)
+            isWriting = isWriting || iCaptureBuffers[i].state != CAPTURE_BUFFER_FREE;
+        iMutexUnlock(&iCaptureMutex);
+        if (!isWriting)
+            break;
+#ifdef _WIN32
+        Sleep(1);
+#else
+        usleep(1000);
+#endif
+    }
+}
+
 void iStrokeText(double x, double y, const char *str, float scale = 0.1)
 {
     glPushMatrix();
@@ -1664,8 +3829,17 @@ void iClear()
 void displayFF(void)
 {
     // iClear();
+    int profile = iProfileBegin("frame", "iDraw");
     iDraw();
+    iProfileEnd(profile);
+    iUpdateCapture();
     glutSwapBuffers();
+    if (!iFirstFramePresented)
+    {
+        glFinish(); // Make sure the first frame really reached the screen before timing it.
+        iProfilerFirstFrame();
+    }
+    iAllocFrameEnd();
 }
 
 void redraw()
@@ -1826,6 +4000,8 @@ void iShowCursor()
 
 void iCloseWindow()
 {
+    iStopRecording();
+    iFinishCaptures();
     if (isGameMode)
     {
         glutLeaveGameMode();
@@ -1845,6 +4021,7 @@ void iOpenWindow(int width = 500, int height = 500, const char *title = "iGraphi
         printf("ERROR: GLUT not initialized. Call glutInit() first.\n");
         return;
     }
+    int profile = iProfileBegin("phase", "iOpenWindow");
     iSmallScreenHeight = iScreenHeight = height;
     iSmallScreenWidth = iScreenWidth = width;
     iWindowTitle = title;
@@ -1879,6 +4056,8 @@ void iOpenWindow(int width = 500, int height = 500, const char *title = "iGraphi
         glutCreateWindow(title);
     }
 
+    windowCreated = 1;
+
     // Basic OpenGL setup
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 
@@ -1924,5 +4103,7 @@ void iOpenWindow(int width = 500, int height = 500, const char *title = "iGraphi
 
     // glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
     glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_CONTINUE_EXECUTION);
+    iProfileEnd(profile);
+    iProfilerWindowReady();
     glutMainLoop();
 }
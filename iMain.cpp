@@ -1,6 +1,8 @@
 #include "iGraphics.h" // v4.0.0
 #include "iFont.h"
 #include "iSound.h"
+#include "iWatch.h"
+#include "levelFormat.h"
 
 // * Optimization
 // TODO: Free images and sprites.
@@ -9,7 +11,6 @@
 // * Tasks
 // TODO: Make the game full screen.
 // TODO: Use Position and Size structs.
-// TODO: Add loading screen.
 
 // * Questions
 // ? How often the iDraw() function is called? Is it constant or device dependent?
@@ -22,6 +23,7 @@
 #define TILE_SIZE (WIDTH / COLUMNS)
 
 #define LEVEL_COUNT 5 // TODO: Get the level count from the levels folder.
+#define TILE_COUNT 180 // Number of images in assets/tiles.
 #define BUTTON_COUNT 19
 #define ICON_COUNT 2
 #define COIN_SPRITE_COUNT 2
@@ -29,22 +31,14 @@
 #define PLAYER_IDLE_SPRITE_COUNT 4
 #define PLAYER_JUMP_SPRITE_COUNT 5
 
-#define MAX_LAYER_COUNT 10
+#define MAX_LAYER_COUNT LEVEL_MAX_LAYERS
 #define MAX_COLLECTABLE_COUNT 30
 #define MAX_PLAYER_COUNT 50
 #define MAX_PLAYER_NAME_LENGTH 20
 #define MAX_FILE_PATH_LENGTH 100
-
-// Bitmasks to encode and decode tile ids.
-#define FLIPPED_HORIZONTALLY_FLAG 0x80000000 // 32nd (leftmost) bit
-#define FLIPPED_VERTICALLY_FLAG 0x40000000 // 31st bit
-#define DOES_COLLIDE_FLAG 0x10000000 // 29th bit
-
-#define FLAG_ID 111
-#define COIN_ID 151
-#define DIAMOND_ID 67
-#define FULL_LIFE_ID 44
-#define NO_LIFE_ID 46
+#define MAX_ASSET_LOADS 64 // Images loaded in parallel by startAssetLoads.
+#define RESOURCE_CPU_BUDGET (24 * 1024 * 1024) // Memory that cached but unused resources (e.g. backgrounds of other levels) may keep.
+#define RESOURCE_GPU_BUDGET (24 * 1024 * 1024)
 
 #define COIN_SCORE 10
 #define DIAMOND_SCORE 50
@@ -57,7 +51,11 @@
 
 #define FONT_PATH "assets/fonts/minecraft_ten.ttf"
 
-const int trapIds[] = {68, 33, 34, 35, 53, 54, 55, 73, 74, 75}; // IDs of the tiles that are traps.
+#define STARTUP_BUDGET_MS 1500 // Default time-to-first-frame budget of --startup-report. Override with --startup-budget=MS.
+#define ALLOC_REPORT_INTERVAL 300    // Frames between two reports of --alloc-report.
+#define ALLOC_TEST_WARMUP_FRAMES 120 // Frames of --alloc-test that may allocate while caches fill up.
+#define ALLOC_TEST_FRAMES 600        // Frames of --alloc-test that must not allocate.
+
 
 enum Page
 {
@@ -71,6 +69,7 @@ enum Page
     GAME_PAGE,
     WIN_PAGE,
     GAME_OVER_PAGE,
+    LOADING_PAGE,
     NONE_PAGE
 };
 
@@ -149,8 +148,9 @@ struct Player
 };
 
 // * Asset management variables
-Image tileImages[ROWS * COLUMNS];
-Image backgroundImage;
+Image tileImages[TILE_COUNT]; // Indexed by tile ID. Only the tiles of the current and the next level are loaded (see loadLevelTiles).
+int backgroundImageHandle = -1; // Backgrounds are cached by the resource manager, so revisiting a level does not reload them.
+Image *backgroundImage = nullptr;
 Image yellowStarImage;
 Image whiteStarImage;
 Image audioOnImage;
@@ -166,6 +166,34 @@ Sprite playerIdleSprite;
 Image playerJumpFrames[PLAYER_JUMP_SPRITE_COUNT];
 Sprite playerJumpSprite;
 
+// Images and sprites loaded by startAssetLoads. In dev mode, they are reloaded when their files change.
+struct AssetImage
+{
+    Image *image;
+    const char *filePath;
+};
+const AssetImage assetImages[] = {
+    {&yellowStarImage, "assets/icons/star_yellow.png"},
+    {&whiteStarImage, "assets/icons/star_white.png"},
+    {&audioOnImage, "assets/icons/audio_on.png"},
+    {&audioOffImage, "assets/icons/audio_off.png"},
+    {&fullLifeImage, "assets/special_tiles/full_life.png"},
+    {&noLifeImage, "assets/special_tiles/no_life.png"},
+};
+struct AssetSprite
+{
+    Sprite *sprite;
+    Image *frames;
+    int frameCount;
+    const char *folderPath; // Frames are resized to the tile size.
+};
+const AssetSprite assetSprites[] = {
+    {&coinSprite, coinFrames, COIN_SPRITE_COUNT, "assets/sprites/coin/"},
+    {&flagSprite, flagFrames, FLAG_SPRITE_COUNT, "assets/sprites/flag/"},
+    {&playerIdleSprite, playerIdleFrames, PLAYER_IDLE_SPRITE_COUNT, "assets/sprites/player/idle/"},
+    {&playerJumpSprite, playerJumpFrames, PLAYER_JUMP_SPRITE_COUNT, "assets/sprites/player/jump/"},
+};
+
 // * Level management variables
 int layerCount = 0;                           // How many layers are in the current level.
 int tiles[MAX_LAYER_COUNT][ROWS][COLUMNS][3]; // Each cell has 3 information: tile id, is flipped horizontally, is flipped vertically.
@@ -183,6 +211,34 @@ int collectedCoinCount = 0;
 int collectedDiamondCount = 0;
 int collectedLifeCount = 0;
 
+// A level read from its files, ready to become the current level (see applyLevelData).
+struct LevelData
+{
+    int level;
+    bool isRead; // false if a level file is missing
+    LevelFile file; // The compiled level (see levelFormat.h)
+    int layerCount;
+    int tiles[MAX_LAYER_COUNT][ROWS][COLUMNS][3];
+    bool doesCollideArray[ROWS][COLUMNS];
+    bool coinArray[ROWS][COLUMNS];
+    bool diamondArray[ROWS][COLUMNS];
+    bool lifeArray[ROWS][COLUMNS];
+    bool trapArray[ROWS][COLUMNS];
+    char backgroundFilePath[MAX_FILE_PATH_LENGTH];
+    int backgroundImageHandle; // The cached background, or -1 if it is decoded into backgroundImage.
+    Image backgroundImage;
+    bool usedTileIds[TILE_COUNT];  // Tiles of this level and the next one.
+    bool isTileLoaded[TILE_COUNT]; // Tiles that were already loaded when the level started loading.
+    Image tileImages[TILE_COUNT];  // The used tiles that were not loaded yet.
+};
+
+// Levels are read on a worker thread while the loading page is shown.
+LevelData levelData;
+bool isLevelLoadActive = false; // true while a worker thread reads a level into levelData.
+bool isLevelDataReady = false;  // levelData holds a level that was read, but is not applied or discarded yet.
+int levelLoadJob = -1;
+int requestedLevel = 1; // The level the loading page waits for.
+
 // * UI management variables
 Page currentPage = NONE_PAGE;
 int currentLevel = 1;
@@ -206,6 +262,29 @@ int horizontalMovementTimer;
 int spriteAnimationTimer;
 int jumpAnimationFrame = 0;
 
+// * Startup variables
+// The window opens before the assets are loaded. They are loaded on the worker threads, and each page only
+// waits for what it shows (see updateStartup).
+int menuBackgroundLoad = -1; // Image load handle
+Image menuBackgroundImage;   // Until it is added to the resource cache
+char menuBackgroundFilePath[MAX_FILE_PATH_LENGTH];
+int assetLoads[MAX_ASSET_LOADS]; // Image load handles
+int assetLoadCount = 0;
+int soundInitJob = -1;
+bool isMenuBackgroundReady = false;
+bool areAssetsReady = false;
+bool isSoundReady = false;
+const char *const musicFilePaths[] = {"assets/sounds/menu_bg.wav", "assets/sounds/game_bg.wav"}; // Decoded while starting up
+
+// * Dev mode variables
+bool isDevModeOn = false;
+bool isLevelReloadPending = false; // A level file changed while another level was loading.
+
+// * Allocation test variables
+bool isAllocTestOn = false;
+int allocTestFrame = 0;
+int allocTestFailedFrames = 0;
+
 // * Game state variables
 char playerName[MAX_PLAYER_NAME_LENGTH + 1] = "";                    // Current player name.
 int playerCount = 0;                                                 // Number of players in the high scores.
@@ -228,6 +307,7 @@ void drawCreditsPage();
 void drawGamePage();
 void drawWinPage();
 void drawGameOverPage();
+void drawLoadingPage();
 // UI rendering functions.
 void drawScore();
 void drawLifeCount();
@@ -270,16 +350,6 @@ bool isNewPlayer()
     return true;
 }
 
-bool isTrap(int id)
-{
-    for (int i = 0; i < sizeof(trapIds) / sizeof(trapIds[0]); i++)
-    {
-        if (id == trapIds[i])
-            return true;
-    }
-    return false;
-}
-
 bool isAlreadyCollected(int row, int col, int collectedCollectableArray[][2], int *collectedCollectableCount)
 {
     for (int i = 0; i < *collectedCollectableCount; i++)
@@ -290,14 +360,6 @@ bool isAlreadyCollected(int row, int col, int collectedCollectableArray[][2], in
     return false;
 }
 
-void mirrorTile(int tileId, MirrorState mirrorState, Sprite *sprite = NULL)
-{
-    if (sprite == NULL)
-        iMirrorImage(&tileImages[tileId], mirrorState);
-    else
-        iMirrorSprite(sprite, mirrorState);
-}
-
 // Checks the number of a collectable type in the grid.
 int collectableCount(bool collectableArray[ROWS][COLUMNS])
 {
@@ -366,141 +428,388 @@ void initializePlayer()
 }
 
 // * Loading functions
-void loadAssets()
+// Uploads the icons and sprite frames of the asset manifest (assetImages and assetSprites), so that no page
+// creates their textures while it is shown.
+void warmAssetTextures()
+{
+    for (const AssetImage &asset : assetImages)
+        iWarmTexture(asset.image);
+    for (const AssetSprite &asset : assetSprites)
+        iWarmSpriteTextures(asset.sprite);
+}
+
+// Uploads the background and the tiles of the current and the next level.
+void warmLevelTextures()
+{
+    iWarmTexture(backgroundImage);
+    iWarmTextures(tileImages, TILE_COUNT);
+}
+
+// Starts decoding the icons and sprite frames on the worker threads. See finishAssetLoads.
+void startAssetLoads()
+{
+    // * The smooth filter of iResizeImage blurs pixel art, so the tiles are pre-resized. The sprite frames are
+    // resized to the tile size with RESIZE_PIXEL_ART instead, which keeps them sharp.
+
+    // Every image is decoded (and sprites resized) in parallel on the worker threads.
+    // Tiles are loaded per level by loadLevel.
+    assetLoadCount = 0;
+    for (const AssetImage &asset : assetImages)
+        assetLoads[assetLoadCount++] = iLoadImageAsync(asset.image, asset.filePath);
+    for (const AssetSprite &asset : assetSprites)
+        assetLoadCount += iLoadFramesFromFolderAsync(asset.frames, asset.folderPath, assetLoads + assetLoadCount, -1, TILE_SIZE, TILE_SIZE, RESIZE_PIXEL_ART);
+}
+
+// Waits for startAssetLoads and sets up the sprites.
+void finishAssetLoads()
 {
-    // * iResizeImage is not used, as using it makes the tiles blurry for some reason. Instead, the image assests are pre-resized.
+    iWaitImages(assetLoads, assetLoadCount);
+    assetLoadCount = 0;
 
-    // Load tiles
-    for (int i = 0; i < 180; i++)
+    // The frames already have the tile size.
+    for (const AssetSprite &asset : assetSprites)
     {
-        // TODO: Optimize this by not loading the tiles that are not used in any level.
-        char filePath[MAX_FILE_PATH_LENGTH];
-        sprintf(filePath, "assets/tiles/%d.png", i);
-        iLoadImage(&tileImages[i], filePath);
+        iInitSprite(asset.sprite);
+        iChangeSpriteFrames(asset.sprite, asset.frames, asset.frameCount);
+        for (int i = 0; i < asset.frameCount; i++)
+            iFreeImage(&asset.frames[i]); // The sprite packed copies of them into its frame set.
     }
+    warmAssetTextures();
+    areAssetsReady = true;
+}
 
-    // Load star image
-    iLoadImage(&yellowStarImage, "assets/icons/star_yellow.png");
-    iLoadImage(&whiteStarImage, "assets/icons/star_white.png");
+// Reads a level into `data`: the grid, the tiles it and the next level use, and the images that are not loaded yet.
+// Only touches `data` (prepared by prepareLevelData on the main thread), so it runs on a worker thread.
+void readLevelData(void *arg)
+{
+    LevelData *data = (LevelData *)arg;
+    memset(data->usedTileIds, 0, sizeof(data->usedTileIds));
+    data->isRead = false;
 
-    // Load audio on/off images
-    iLoadImage(&audioOnImage, "assets/icons/audio_on.png");
-    iLoadImage(&audioOffImage, "assets/icons/audio_off.png");
+    LevelFile *file = &data->file;
+    if (!readLevelFile(data->level, file))
+        return;
+    if (file->header.columns != COLUMNS || file->header.rows != ROWS || file->header.layerCount != data->layerCount)
+    {
+        printf("Level %d does not fit the screen or has changed while loading\n", data->level);
+        return;
+    }
 
-    // Load life images
-    iLoadImage(&fullLifeImage, "assets/special_tiles/full_life.png");
-    iLoadImage(&noLifeImage, "assets/special_tiles/no_life.png");
+    for (int layer = 0; layer < data->layerCount; layer++)
+    {
+        const uint16_t *cells = levelCells(file, layer);
+        for (int row = 0; row < ROWS; row++)
+        {
+            for (int col = 0; col < COLUMNS; col++)
+            {
+                uint16_t cell = cells[row * COLUMNS + col];
+                data->tiles[layer][row][col][0] = (int)(cell & LEVEL_CELL_ID_MASK) - 1; // -1 for an empty cell
+                data->tiles[layer][row][col][1] = (cell & LEVEL_CELL_FLIPPED_HORIZONTALLY) != 0;
+                data->tiles[layer][row][col][2] = (cell & LEVEL_CELL_FLIPPED_VERTICALLY) != 0;
+            }
+        }
+    }
 
-    // Load coin sprite
-    iLoadFramesFromFolder(coinFrames, "assets/sprites/coin/");
-    iInitSprite(&coinSprite);
-    iChangeSpriteFrames(&coinSprite, coinFrames, COIN_SPRITE_COUNT);
-    iResizeSprite(&coinSprite, TILE_SIZE, TILE_SIZE);
+    bool(*masks[LEVEL_MASK_COUNT])[COLUMNS] = {data->doesCollideArray, data->coinArray, data->diamondArray, data->lifeArray, data->trapArray};
+    for (int mask = 0; mask < LEVEL_MASK_COUNT; mask++)
+    {
+        const uint32_t *rowMasks = levelMask(file, mask);
+        for (int row = 0; row < ROWS; row++)
+        {
+            for (int col = 0; col < COLUMNS; col++)
+                masks[mask][row][col] = (rowMasks[row] >> col) & 1;
+        }
+    }
 
-    // Load flag sprite
-    iLoadFramesFromFolder(flagFrames, "assets/sprites/flag/");
-    iInitSprite(&flagSprite);
-    iChangeSpriteFrames(&flagSprite, flagFrames, FLAG_SPRITE_COUNT);
-    iResizeSprite(&flagSprite, TILE_SIZE, TILE_SIZE);
+    LevelFileHeader nextHeader;
+    for (int id = 0; id < TILE_COUNT; id++)
+        data->usedTileIds[id] = isLevelTileUsed(&file->header, id);
+    if (data->level < LEVEL_COUNT && readLevelHeader(data->level + 1, &nextHeader))
+    {
+        for (int id = 0; id < TILE_COUNT; id++)
+            data->usedTileIds[id] |= isLevelTileUsed(&nextHeader, id); // Preloaded, so that moving on to the next level is quick.
+    }
+
+    if (data->backgroundImageHandle < 0)
+        iLoadImage2(&data->backgroundImage, data->backgroundFilePath);
+
+    for (int id = 0; id < TILE_COUNT; id++)
+    {
+        if (data->usedTileIds[id] && !data->isTileLoaded[id])
+        {
+            char filePath[MAX_FILE_PATH_LENGTH];
+            sprintf(filePath, "assets/tiles/%d.png", id);
+            iLoadImage2(&data->tileImages[id], filePath);
+        }
+    }
+    data->isRead = true;
+}
+
+// Starts filling `data` for `level` on the main thread: reads the level header and notes what is already loaded.
+bool prepareLevelData(LevelData *data, int level)
+{
+    data->level = level;
+    data->isRead = false;
+    LevelFileHeader header;
+    if (!readLevelHeader(level, &header))
+        return false;
+    data->layerCount = header.layerCount;
+    sprintf(data->backgroundFilePath, "assets/backgrounds/%s", header.background);
+
+    data->backgroundImageHandle = iFindImage(data->backgroundFilePath); // Keeps a cached background from being evicted.
+    data->backgroundImage.data = nullptr;
+    data->backgroundImage.textureId = 0;
+    data->backgroundImage.dataOwner = PIXELS_MALLOC;
+    data->backgroundImage.alphaMask = nullptr;
+    for (int id = 0; id < TILE_COUNT; id++)
+    {
+        data->isTileLoaded[id] = iIsImageLoaded(&tileImages[id]);
+        data->tileImages[id].data = nullptr;
+        data->tileImages[id].textureId = 0;
+        data->tileImages[id].dataOwner = PIXELS_MALLOC;
+        data->tileImages[id].alphaMask = nullptr;
+    }
+    return true;
+}
 
-    // Load player idle sprite
-    iLoadFramesFromFolder(playerIdleFrames, "assets/sprites/player/idle/");
-    iInitSprite(&playerIdleSprite);
-    iChangeSpriteFrames(&playerIdleSprite, playerIdleFrames, PLAYER_IDLE_SPRITE_COUNT);
-    iResizeSprite(&playerIdleSprite, TILE_SIZE, TILE_SIZE);
+// Frees what `data` loaded without applying it.
+void discardLevelData(LevelData *data)
+{
+    iReleaseResource(data->backgroundImageHandle);
+    data->backgroundImageHandle = -1;
+    iFreeImage(&data->backgroundImage);
+    for (int id = 0; id < TILE_COUNT; id++)
+        iFreeImage(&data->tileImages[id]);
+}
 
-    // Load player jump sprite
-    iLoadFramesFromFolder(playerJumpFrames, "assets/sprites/player/jump/");
-    iInitSprite(&playerJumpSprite);
-    iChangeSpriteFrames(&playerJumpSprite, playerJumpFrames, PLAYER_JUMP_SPRITE_COUNT);
-    iResizeSprite(&playerJumpSprite, TILE_SIZE, TILE_SIZE);
+// Makes the level in `data` the current level. Runs on the main thread between two frames, so the game
+// never sees a half-loaded level.
+void applyLevelData(LevelData *data)
+{
+    layerCount = data->layerCount;
+    memcpy(tiles, data->tiles, sizeof(tiles));
+    memcpy(doesCollideArray, data->doesCollideArray, sizeof(doesCollideArray));
+    memcpy(coinArray, data->coinArray, sizeof(coinArray));
+    memcpy(diamondArray, data->diamondArray, sizeof(diamondArray));
+    memcpy(lifeArray, data->lifeArray, sizeof(lifeArray));
+    memcpy(trapArray, data->trapArray, sizeof(trapArray));
+
+    int newBackgroundImageHandle = data->backgroundImageHandle;
+    if (newBackgroundImageHandle < 0 && data->backgroundImage.data != nullptr)
+        newBackgroundImageHandle = iAddImage(data->backgroundFilePath, &data->backgroundImage);
+    data->backgroundImageHandle = -1;
+    if (newBackgroundImageHandle >= 0)
+    {
+        iReleaseResource(backgroundImageHandle); // Kept in the cache while the memory budget allows.
+        backgroundImageHandle = newBackgroundImageHandle;
+        backgroundImage = iGetImage(backgroundImageHandle);
+    }
+
+    // Only the tiles used by this level and the next one stay loaded.
+    for (int id = 0; id < TILE_COUNT; id++)
+    {
+        if (data->tileImages[id].data != nullptr && !iIsImageLoaded(&tileImages[id]))
+        {
+            tileImages[id] = data->tileImages[id];
+            data->tileImages[id].data = nullptr;
+        }
+        else if (!data->usedTileIds[id] && iIsImageLoaded(&tileImages[id]))
+        {
+            iFreeImage(&tileImages[id]);
+        }
+        iFreeImage(&data->tileImages[id]);
+    }
+    warmLevelTextures();
 }
 
+// Loads a level right away. Used at startup, before there is a window to show the loading page in.
 void loadLevel(int level)
 {
-    // Grid arrays should be initialized every time a level is loaded.
-    initializeGridArray(doesCollideArray, false);
-    initializeGridArray(coinArray, false);
-    initializeGridArray(diamondArray, false);
-    initializeGridArray(lifeArray, false);
-    initializeGridArray(trapArray, false);
+    if (!prepareLevelData(&levelData, level))
+        return;
+    readLevelData(&levelData);
+    if (levelData.isRead)
+        applyLevelData(&levelData);
+    else
+        discardLevelData(&levelData);
+}
 
-    char levelMetadataFilePath[MAX_FILE_PATH_LENGTH];
-    sprintf(levelMetadataFilePath, "levels/level%d/metadata.txt", level);
-    FILE *levelMetadataFile = fopen(levelMetadataFilePath, "r");
-    if (levelMetadataFile == NULL)
+// Starts reading a level on a worker thread. Only one level is read at a time.
+void startLevelLoad(int level)
+{
+    if (isLevelLoadActive || isLevelDataReady)
+        return;
+    if (!prepareLevelData(&levelData, level))
+        return;
+    levelLoadJob = iSubmitJob(readLevelData, &levelData);
+    isLevelLoadActive = true;
+}
+
+// Called every frame. Notes when the worker thread finished reading a level, so that a prefetched level does not
+// keep levelData busy until it is entered.
+void finishLevelLoad()
+{
+    if (!isLevelLoadActive || !iIsJobDone(levelLoadJob))
+        return;
+    iWaitJob(levelLoadJob);
+    isLevelLoadActive = false;
+    isLevelDataReady = true;
+}
+
+// Reads the next level in the background while the win page is shown, so "NEXT LEVEL" switches instantly.
+void prefetchLevel(int level)
+{
+    if (level <= LEVEL_COUNT)
+        startLevelLoad(level);
+}
+
+// Starts decoding the background of the current level, which the menu pages show too.
+void startMenuBackgroundLoad()
+{
+    LevelFileHeader header;
+    if (!readLevelHeader(currentLevel, &header))
+        return;
+    sprintf(menuBackgroundFilePath, "assets/backgrounds/%s", header.background);
+    menuBackgroundLoad = iLoadImageAsync(&menuBackgroundImage, menuBackgroundFilePath);
+}
+
+void finishMenuBackgroundLoad()
+{
+    isMenuBackgroundReady = true;
+    if (menuBackgroundFilePath[0] == '\0' || !iWaitImage(menuBackgroundLoad))
+        return;
+    backgroundImageHandle = iAddImage(menuBackgroundFilePath, &menuBackgroundImage);
+    backgroundImage = iGetImage(backgroundImageHandle);
+    iWarmTexture(backgroundImage);
+
+    // Once the background is cached, reading the level does not decode it again.
+    if (layerCount == 0)
+        prefetchLevel(currentLevel);
+}
+
+void finishSoundInit()
+{
+    iFinishSoundInit(soundInitJob);
+    isSoundReady = true;
+    if (isMusicPlaying)
+        playBackgroundMusic(currentMusicType); // Requested before the audio device was open
+}
+
+// Called every frame. Sets up what finished loading since the last frame, and waits for what the current page needs.
+void updateStartup()
+{
+    if (!isMenuBackgroundReady)
+        finishMenuBackgroundLoad(); // Every page shows it. It is usually decoded while the window opens.
+    if (!areAssetsReady)
     {
-        printf("levels/level%d/metadata.txt file not found\n", level);
+        bool isLoaded = true;
+        for (int i = 0; i < assetLoadCount && isLoaded; i++)
+            isLoaded = iIsJobDone(assetLoads[i]);
+        if (isLoaded || (currentPage != NAME_INPUT_PAGE && currentPage != MENU_PAGE)) // The other pages show icons or sprites.
+            finishAssetLoads();
+    }
+    if (!isSoundReady && iIsJobDone(soundInitJob))
+        finishSoundInit();
+    finishLevelLoad();
+}
+
+// * Dev mode functions
+// Reloads the current level from its files, keeping the player's position, the score and the collected collectables.
+void reloadLevel()
+{
+    if (isLevelLoadActive)
+    {
+        isLevelReloadPending = true; // levelData is in use until the worker thread finishes reading.
         return;
     }
-    char levelBackgroundFileName[50];
-    fscanf(levelMetadataFile, "%d %s", &layerCount, levelBackgroundFileName);
-    char levelBackgroundFilePath[MAX_FILE_PATH_LENGTH];
-    sprintf(levelBackgroundFilePath, "assets/backgrounds/%s", levelBackgroundFileName);
-    fclose(levelMetadataFile);
+    if (isLevelDataReady)
+    {
+        discardLevelData(&levelData); // Read before the change
+        isLevelDataReady = false;
+    }
+    isLevelReloadPending = false;
+    loadLevel(currentLevel);
+    printf("Level %d reloaded\n", currentLevel);
+}
 
-    // TODO: Optimize this by not loading the background if it was loaded once.
-    iLoadImage(&backgroundImage, levelBackgroundFilePath);
+void reloadSprite(const AssetSprite *asset)
+{
+    int handles[MAX_ASSET_LOADS];
+    int handleCount = iLoadFramesFromFolderAsync(asset->frames, asset->folderPath, handles, -1, TILE_SIZE, TILE_SIZE, RESIZE_PIXEL_ART);
+    iWaitImages(handles, handleCount);
+    iChangeSpriteFrames(asset->sprite, asset->frames, asset->frameCount); // Keeps the sprite mirrored if it was.
+    for (int i = 0; i < asset->frameCount; i++)
+        iFreeImage(&asset->frames[i]);
+    iWarmSpriteTextures(asset->sprite);
+}
 
-    for (int layer = 0; layer < layerCount; layer++)
+// Reloads only what a changed file affects: the current level, a tile, an image or a sprite.
+void reloadChangedFile(const char *path)
+{
+    if (!areAssetsReady)
+        finishAssetLoads(); // Reloading an asset while it is still loading would race with the load.
+    char filePath[MAX_FILE_PATH_LENGTH];
+    char mapPath[MAX_FILE_PATH_LENGTH];
+    sprintf(filePath, LEVEL_FILE_PATH, currentLevel);
+    sprintf(mapPath, LEVEL_MAP_PATH, currentLevel);
+    if (strcmp(path, filePath) == 0 || strcmp(path, mapPath) == 0 || strcmp(path, LEVEL_TILESET_PATH) == 0)
+    {
+        reloadLevel();
+        return;
+    }
+
+    int tileId;
+    if (sscanf(path, "assets/tiles/%d.png", &tileId) == 1 && tileId >= 0 && tileId < TILE_COUNT)
     {
-        char layerFilePath[MAX_FILE_PATH_LENGTH];
-        sprintf(layerFilePath, "levels/level%d/layer_%d_customized.csv", level, layer);
-        FILE *layerFile = fopen(layerFilePath, "r");
-        if (layerFile == NULL)
+        sprintf(filePath, "assets/tiles/%d.png", tileId);
+        if (strcmp(path, filePath) == 0 && iIsImageLoaded(&tileImages[tileId])) // Other tiles are loaded when a level uses them.
         {
-            printf("levels/level%d/layer_%d_customized.csv file not found\n", level, layer);
-            return;
+            iFreeImage(&tileImages[tileId]);
+            iLoadImage2(&tileImages[tileId], filePath);
+            iWarmTexture(&tileImages[tileId]);
+            printf("%s reloaded\n", path);
         }
+        return;
+    }
 
-        char line[500];
-        int row = 0;
-        while (fgets(line, 500, layerFile))
+    for (const AssetImage &asset : assetImages)
+    {
+        if (strcmp(path, asset.filePath) == 0)
         {
-            char *cell;
-            cell = strtok(line, ",\n");
-            int col = 0;
-            while (cell)
-            {
-                int encodedId = atoi(cell);
-                if (encodedId == -1)
-                {
-                    tiles[layer][row][col][0] = -1;
-                    tiles[layer][row][col][1] = false;
-                    tiles[layer][row][col][2] = false;
-                }
-                else
-                {
-                    bool isFlippedHorizontally = (encodedId & FLIPPED_HORIZONTALLY_FLAG) != 0;
-                    bool isFlippedVertically = (encodedId & FLIPPED_VERTICALLY_FLAG) != 0;
-                    bool doesCollide = (encodedId & DOES_COLLIDE_FLAG) != 0;
-
-                    // Mask out the flags to get the decoded ID.
-                    int id = encodedId & ~(FLIPPED_HORIZONTALLY_FLAG | FLIPPED_VERTICALLY_FLAG | DOES_COLLIDE_FLAG);
-                    tiles[layer][row][col][0] = id;
-                    tiles[layer][row][col][1] = isFlippedHorizontally;
-                    tiles[layer][row][col][2] = isFlippedVertically;
-                    if (doesCollide)
-                        doesCollideArray[row][col] = true;
-
-                    if (id == COIN_ID)
-                        coinArray[row][col] = true;
-                    else if (id == DIAMOND_ID)
-                        diamondArray[row][col] = true;
-                    else if (isTrap(id))
-                        trapArray[row][col] = true;
-                    else if (id == FULL_LIFE_ID)
-                        lifeArray[row][col] = true;
-                }
-                cell = strtok(NULL, ",\n"); // Get the next cell.
-                col++;
-            }
-            row++;
+            iFreeImage(asset.image);
+            iWaitImage(iLoadImageAsync(asset.image, asset.filePath));
+            iWarmTexture(asset.image);
+            printf("%s reloaded\n", path);
+            return;
         }
-        fclose(layerFile);
+    }
+    for (const AssetSprite &asset : assetSprites)
+    {
+        if (strncmp(path, asset.folderPath, strlen(asset.folderPath)) == 0)
+        {
+            reloadSprite(&asset);
+            printf("%s reloaded\n", asset.folderPath);
+            return;
+        }
+    }
+
+    if (iReloadResources(path) > 0) // Cached images, e.g. the backgrounds
+    {
+        warmLevelTextures();
+        printf("%s reloaded\n", path);
     }
 }
 
+// --dev: picks up changes to the files of the levels and assets, once per frame.
+void updateDevMode()
+{
+    if (!isDevModeOn)
+        return;
+    iPollFileChanges(reloadChangedFile);
+    if (isLevelReloadPending)
+        reloadLevel();
+}
+
 void loadPlayerName()
 {
     FILE *playerNameFile = fopen("saves/current_player.txt", "r");
@@ -673,17 +982,49 @@ void resetGame()
     lifeCount = 3;
 }
 
-void changeLevel(int level)
+// Called every frame of the loading page. Switches to the requested level once it is read.
+void updateLevelLoad()
 {
-    resetGame();
+    if (!isLevelLoadActive && !isLevelDataReady)
+    {
+        startLevelLoad(requestedLevel);
+        if (!isLevelLoadActive)
+        {
+            currentPage = LEVELS_PAGE; // The level files are missing.
+            return;
+        }
+    }
+    finishLevelLoad();
+    if (!isLevelDataReady)
+        return;
+    isLevelDataReady = false;
 
-    loadLevel(level);
-    currentLevel = level;
+    if (levelData.level != requestedLevel || !levelData.isRead)
+    {
+        // A prefetch of another level finished first, or the level files are broken.
+        bool isBroken = levelData.level == requestedLevel;
+        discardLevelData(&levelData);
+        if (isBroken)
+            currentPage = LEVELS_PAGE;
+        return;
+    }
 
+    applyLevelData(&levelData);
+    currentLevel = requestedLevel;
     resumeGame();
     isResumable = true;
 }
 
+// Switches to a level through the loading page. If the level was prefetched, the switch is immediate.
+void changeLevel(int level)
+{
+    resetGame();
+
+    requestedLevel = level;
+    currentPage = LOADING_PAGE;
+    updateLevelLoad();
+}
+
 void checkAndUpdateHighScores()
 {
     for (int i = 0; i < playerCount; i++)
@@ -840,6 +1181,7 @@ void animateHorizontalMovement()
 
 void animateSprites()
 {
+    int profile = iProfileBegin("timer", "animateSprites");
     iAnimateSprite(&coinSprite);
     iAnimateSprite(&flagSprite);
 
@@ -855,6 +1197,7 @@ void animateSprites()
     }
     else
         iAnimateSprite(&playerIdleSprite);
+    iProfileEnd(profile);
 }
 
 // * Game logic functions
@@ -983,6 +1326,7 @@ void gameStateUpdate()
 
         resetGame();
         currentPage = WIN_PAGE;
+        prefetchLevel(currentLevel + 1);
 
         stopBackgroundMusic();
         if (isSoundOn)
@@ -990,8 +1334,45 @@ void gameStateUpdate()
     }
 }
 
+// Checks that the steady-state GAME_PAGE frame does not allocate. Exits with the result when done.
+void runAllocationTest()
+{
+    if (!isAllocTestOn || currentPage != GAME_PAGE)
+        return;
+
+    allocTestFrame++;
+    if (allocTestFrame <= ALLOC_TEST_WARMUP_FRAMES)
+    {
+        iResetAllocStats();
+        return;
+    }
+
+    if (iAllocLastFrame.allocations > 0 || iAllocLastFrame.texturesCreated > 0)
+        allocTestFailedFrames++;
+
+    if (allocTestFrame == ALLOC_TEST_WARMUP_FRAMES + ALLOC_TEST_FRAMES)
+    {
+        iPrintAllocReport();
+        if (allocTestFailedFrames > 0)
+            printf("Allocation test FAILED: %d of %d frames allocated\n", allocTestFailedFrames, ALLOC_TEST_FRAMES);
+        else
+            printf("Allocation test PASSED: %d frames without allocations\n", ALLOC_TEST_FRAMES);
+        exit(allocTestFailedFrames > 0 ? 1 : 0);
+    }
+}
+
 void iDraw()
 {
+    if (iWorkerCount == 0)
+        iRunQueuedJob(); // Without worker threads (a single core), background jobs run here, one per frame.
+    updateStartup();
+    runAllocationTest();
+    updateDevMode();
+
+    // What the pages show is warmed up once it is loaded, so only the loading page (which applies the level)
+    // and the startup frames may upload textures.
+    iSetSteadyFrame(isMenuBackgroundReady && areAssetsReady && currentPage != LOADING_PAGE);
+
     switch (currentPage)
     {
     case NAME_INPUT_PAGE:
@@ -1024,7 +1405,11 @@ void iDraw()
     case GAME_OVER_PAGE:
         drawGameOverPage();
         break;
+    case LOADING_PAGE:
+        drawLoadingPage();
+        break;
     }
+    iSetSteadyFrame(false); // The input handlers may load images, e.g. changeLevel.
 }
 
 // * UI Widget: Small widget function definitions
@@ -1088,24 +1473,12 @@ void drawTile(int layer, int row, int col, Sprite *sprite)
     int x = col * TILE_SIZE;
     int y = (ROWS - row - 1) * TILE_SIZE;
 
-    if (isFlippedHorizontally)
-        mirrorTile(tileId, HORIZONTAL, sprite);
-    if (isFlippedVertically)
-        mirrorTile(tileId, VERTICAL, sprite);
-
+    // Mirrored with the texture coordinates, the pixels are left alone.
+    int mirror = (isFlippedHorizontally ? HORIZONTAL : NO_MIRROR) | (isFlippedVertically ? VERTICAL : NO_MIRROR);
     if (sprite == NULL)
-        iShowLoadedImage(x, y, &tileImages[tileId]);
+        iShowLoadedImage2(x, y, &tileImages[tileId], -1, -1, (MirrorState)mirror);
     else
-    {
-        iSetSpritePosition(sprite, x, y);
-        iShowSprite(sprite);
-    }
-
-    // Mirror the tile back to its original state.
-    if (isFlippedHorizontally)
-        mirrorTile(tileId, HORIZONTAL, sprite);
-    if (isFlippedVertically)
-        mirrorTile(tileId, VERTICAL, sprite);
+        iShowFrame(x, y, sprite->frameSet, sprite->currentFrame, (MirrorState)mirror); // The current frame of the shared animation
 }
 
 void drawTextButton(TextButton &button)
@@ -1166,7 +1539,7 @@ void drawIconButton(IconButton &icon)
 void drawNameInputPage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
     iSetColor(0, 0, 0);
 
@@ -1190,7 +1563,7 @@ void drawNameInputPage()
 void drawMenuPage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
     iSetColor(0, 0, 0);
 
@@ -1215,7 +1588,7 @@ void drawMenuPage()
 void drawLevelsPage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
     iSetColor(0, 0, 0);
     iShowText(WIDTH / 2 - 120, HEIGHT - 100, "Levels", FONT_PATH, 80);
@@ -1234,7 +1607,7 @@ void drawLevelsPage()
 void drawHighScoresPage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
     iSetColor(0, 0, 0);
     iShowText(WIDTH / 2 - 210, HEIGHT - 100, "High Scores", FONT_PATH, 80);
@@ -1271,7 +1644,7 @@ void drawHighScoresPage()
 void drawOptionsPage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
     iSetColor(0, 0, 0);
     iShowText(WIDTH / 2 - 140, HEIGHT - 100, "Options", FONT_PATH, 80);
@@ -1297,7 +1670,7 @@ void drawOptionsPage()
 void drawHelpPage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
     iSetColor(0, 0, 0);
     iShowText(WIDTH / 2 - 100, HEIGHT - 100, "Help", FONT_PATH, 80);
@@ -1333,7 +1706,7 @@ void drawHelpPage()
 void drawCreditsPage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
     iSetColor(0, 0, 0);
     iShowText(WIDTH / 2 - 130, HEIGHT - 100, "Credits", FONT_PATH, 80);
@@ -1364,11 +1737,14 @@ void drawCreditsPage()
 void drawGamePage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
+    int profile = iProfileBegin("draw", "drawTiles");
     drawTiles();
+    iProfileEnd(profile);
 
     // Draw player
+    profile = iProfileBegin("draw", "drawPlayer");
     if (player.velocityY > 0)
     {
         iSetSpritePosition(&playerJumpSprite, player.x, player.y);
@@ -1379,15 +1755,18 @@ void drawGamePage()
         iSetSpritePosition(&playerIdleSprite, player.x, player.y);
         iShowSprite(&playerIdleSprite);
     }
+    iProfileEnd(profile);
 
+    profile = iProfileBegin("draw", "drawHud");
     drawScore();
     drawLifeCount();
+    iProfileEnd(profile);
 }
 
 void drawWinPage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
     char levelText[50];
     sprintf(levelText, "Level %d", currentLevel);
@@ -1428,7 +1807,7 @@ void drawWinPage()
 void drawGameOverPage()
 {
     iClear();
-    iShowLoadedImage(0, 0, &backgroundImage);
+    iShowLoadedImage(0, 0, backgroundImage);
 
     iSetColor(0, 0, 0);
     iShowText(WIDTH / 2 - 245, HEIGHT / 2 + 100, "Game Over", FONT_PATH, 100);
@@ -1439,6 +1818,22 @@ void drawGameOverPage()
     drawTextButton(buttons[13]);
 }
 
+void drawLoadingPage()
+{
+    updateLevelLoad();
+    if (currentPage != LOADING_PAGE)
+        return; // Loaded; the level is drawn from the next frame on.
+
+    iClear();
+    iShowLoadedImage(0, 0, backgroundImage);
+
+    char loadingText[20];
+    int dotCount = (int)(iGetTimeMs() / 300) % 4;
+    sprintf(loadingText, "Loading%.*s", dotCount, "...");
+    iSetColor(0, 0, 0);
+    iShowText(WIDTH / 2 - 160, HEIGHT / 2, loadingText, FONT_PATH, 80);
+}
+
 // * Keyboard functions
 void iKeyboard(unsigned char key, int state)
 {
@@ -1446,7 +1841,7 @@ void iKeyboard(unsigned char key, int state)
     switch (key)
     {
     case 27:                                                              // Escape key
-        if (!(currentPage == NAME_INPUT_PAGE && strlen(playerName) == 0)) // No going back from the name input page when there is no player name.
+        if (!(currentPage == NAME_INPUT_PAGE && strlen(playerName) == 0) && currentPage != LOADING_PAGE) // No going back from the name input page when there is no player name.
             pauseGame();
         break;
     case ' ': // Space key
@@ -1495,6 +1890,17 @@ void iKeyboard(unsigned char key, int state)
 // GLUT_KEY_F1, GLUT_KEY_F2, GLUT_KEY_F3, GLUT_KEY_F4, GLUT_KEY_F5, GLUT_KEY_F6, GLUT_KEY_F7, GLUT_KEY_F8, GLUT_KEY_F9, GLUT_KEY_F10, GLUT_KEY_F11, GLUT_KEY_F12, GLUT_KEY_LEFT, GLUT_KEY_UP, GLUT_KEY_RIGHT, GLUT_KEY_DOWN, GLUT_KEY_PAGE_UP, GLUT_KEY_PAGE_DOWN, GLUT_KEY_HOME, GLUT_KEY_END, GLUT_KEY_INSERT
 void iSpecialKeyboard(unsigned char key, int state)
 {
+    // Screenshots and recordings are saved in the captures/ folder, on every page.
+    if (key == GLUT_KEY_F12 && state == GLUT_DOWN)
+        iCaptureFrame();
+    if (key == GLUT_KEY_F11 && state == GLUT_DOWN)
+    {
+        if (iIsRecordingFrames())
+            iStopRecording();
+        else
+            iStartRecording();
+    }
+
     if (currentPage != GAME_PAGE)
         return;
 
@@ -1583,25 +1989,111 @@ void iMouseDrag(int mx, int my)
 {
 }
 
+// * Startup functions
+// Runs one step of the startup sequence, timed as a phase of the startup report.
+void runStartupPhase(const char *name, void (*phase)(void))
+{
+    int profile = iProfileBegin("phase", name);
+    phase();
+    iProfileEnd(profile);
+}
+
+// --startup-report: time every startup phase and asset, print the breakdown after the first frame and exit.
+// --startup-budget=MS: exit with a non-zero status if the first frame takes longer than MS milliseconds.
+// --alloc-report: print heap and texture allocations per frame and per profiling scope every few seconds.
+// --alloc-test: start level 1 and exit with a non-zero status if a GAME_PAGE frame allocates after warm-up.
+// Both need a build with -DI_ALLOCATION_HOOKS, so that operator new is tracked.
+// --dev: reload levels and assets when their files change, e.g. when a level is saved in Tiled.
+// --record[=FOLDER]: record every frame from the first one, as with F11.
+// Exits if the allocations of operator new are not tracked, since the reports would miss most of them.
+void requireAllocationHooks(const char *option)
+{
+#ifndef I_ALLOCATION_HOOKS
+    printf("ERROR: %s needs a build with -DI_ALLOCATION_HOOKS, e.g. CXXFLAGS=-DI_ALLOCATION_HOOKS ./runner.sh\n", option);
+    exit(1);
+#endif
+}
+
+void parseCommandLineOptions(int argc, char *argv[])
+{
+    bool isStartupReportOn = false;
+    double startupBudgetMs = STARTUP_BUDGET_MS;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--startup-report") == 0)
+            isStartupReportOn = true;
+        else if (strncmp(argv[i], "--startup-budget=", 17) == 0)
+        {
+            isStartupReportOn = true;
+            startupBudgetMs = atof(argv[i] + 17);
+        }
+        else if (strcmp(argv[i], "--alloc-report") == 0)
+        {
+            requireAllocationHooks(argv[i]);
+            iEnableAllocTracking(ALLOC_REPORT_INTERVAL);
+        }
+        else if (strcmp(argv[i], "--alloc-test") == 0)
+        {
+            requireAllocationHooks(argv[i]);
+            isAllocTestOn = true;
+            iEnableAllocTracking();
+        }
+        else if (strcmp(argv[i], "--dev") == 0)
+            isDevModeOn = true;
+        else if (strcmp(argv[i], "--record") == 0)
+            iStartRecording();
+        else if (strncmp(argv[i], "--record=", 9) == 0)
+            iStartRecording(argv[i] + 9);
+    }
+
+    if (isStartupReportOn)
+        iEnableStartupReport(startupBudgetMs);
+}
+
 int main(int argc, char *argv[])
 {
+    parseCommandLineOptions(argc, argv);
+
     initializePlayer();
     initializeCollectedCollectables(collectedCoins);
     initializeCollectedCollectables(collectedDiamonds);
     initializeCollectedCollectables(collectedLives);
-
-    loadAssets();
-    loadLevel(currentLevel);
-    loadPlayerName();
-    loadHighScores();
-    loadOptions();
+    iSetResourceBudget(RESOURCE_CPU_BUDGET, RESOURCE_GPU_BUDGET);
+    iSetGpuResidentImages(true); // Nothing reads the pixels of the images after they are drawn.
+
+    // Only the font and the menu background are needed for the first frame. Everything else loads on the
+    // worker threads while the window opens and the first pages are shown (see updateStartup).
+    runStartupPhase("startLoads", []()
+                    {
+                        // Images and fonts are read from the asset pack when it exists (see helpers/asset_packer.cpp), and from the files otherwise.
+                        // In dev mode, the files are always read, so that changes to them show up.
+                        if (!isDevModeOn)
+                            iOpenPack("assets/assets.pack");
+                        startMenuBackgroundLoad();
+                        startAssetLoads();
+                        soundInitJob = iInitializeSoundAsync(musicFilePaths, sizeof(musicFilePaths) / sizeof(musicFilePaths[0]));
+                    });
+    if (isDevModeOn)
+    {
+        iWatchFolder("levels");
+        iWatchFolder("level_editor");
+        iWatchFolder("assets");
+    }
+    runStartupPhase("loadSaves", []()
+                    {
+                        loadPlayerName();
+                        loadHighScores();
+                        loadOptions();
+                    });
 
     if (strlen(playerName) == 0)
         currentPage = NAME_INPUT_PAGE;
     else
         currentPage = MENU_PAGE;
 
+    int glutInitProfile = iProfileBegin("phase", "glutInit");
     glutInit(&argc, argv); // argc and argv are used for command line arguments.
+    iProfileEnd(glutInitProfile);
 
     gameStateUpdateTimer = iSetTimer(10, gameStateUpdate);
     horizontalMovementTimer = iSetTimer(10, animateHorizontalMovement);
@@ -1610,9 +2102,12 @@ int main(int argc, char *argv[])
     iPauseTimer(horizontalMovementTimer);
     iPauseTimer(spriteAnimationTimer);
 
-    iInitializeFont();
-    iInitializeSound();
-    playBackgroundMusic(MENU_MUSIC);
+    runStartupPhase("iInitializeFont", []()
+                    { iInitializeFont(); });
+    playBackgroundMusic(MENU_MUSIC); // Starts playing once the sound is initialized.
+
+    if (isAllocTestOn)
+        changeLevel(currentLevel);
 
     iOpenWindow(WIDTH, HEIGHT, TITLE);
 
@@ -0,0 +1,382 @@
+/***
+ * iPack.h: v0.1.0
+ * A packed asset archive for iGraphics programs.
+ * An archive holds pre-decoded images (already flipped for OpenGL, raw or LZ4-compressed)
+ * and raw blobs such as fonts, behind a name-sorted index. The archive is memory mapped,
+ * so raw entries are used straight from the mapping without being read or copied.
+ * Archives are written by helpers/asset_packer.cpp.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define PACK_MAGIC "RRPK"
+#define PACK_VERSION 1
+#define PACK_ALIGNMENT 16 // Entry data offsets are aligned to this many bytes.
+#define MAX_PACK_NAME_LEN 96
+
+enum PackEntryType
+{
+    PACK_IMAGE, // Decoded pixels, bottom row first, `channels` bytes per pixel.
+    PACK_BLOB   // Raw file contents, e.g. a font.
+};
+
+enum PackCompression
+{
+    PACK_RAW,
+    PACK_LZ4 // LZ4 block format, decompressed to `rawSize` bytes.
+};
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t indexOffset; // Offset of the PackEntry array, sorted by name.
+} PackHeader;
+
+typedef struct
+{
+    char name[MAX_PACK_NAME_LEN]; // Path relative to the game folder, e.g. "assets/tiles/3.png".
+    uint32_t type;
+    uint32_t compression;
+    uint32_t offset; // Offset of the entry data from the start of the archive.
+    uint32_t size;   // Stored size.
+    uint32_t rawSize;
+    int32_t width, height, channels; // Only meaningful for images.
+    uint32_t reserved;
+} PackEntry;
+
+typedef struct
+{
+    unsigned char *base; // Start of the mapping, nullptr if no archive is open.
+    size_t size;
+    const PackEntry *entries;
+    int entryCount;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+} AssetPack;
+
+AssetPack iAssetPack = {};
+
+// Copies `path` to `name`, collapsing repeated slashes and converting backslashes, so that
+// "assets/sprites/coin//151.png" and "assets\sprites\coin\151.png" find the same entry.
+void iNormalizePackName(char *name, const char *path, int capacity = MAX_PACK_NAME_LEN)
+{
+    int length = 0;
+    if (strncmp(path, "./", 2) == 0)
+        path += 2;
+    for (; *path && length < capacity - 1; path++)
+    {
+        char c = (*path == '\\') ? '/' : *path;
+        if (c == '/' && length > 0 && name[length - 1] == '/')
+            continue;
+        name[length++] = c;
+    }
+    name[length] = '\0';
+}
+
+// * LZ4 block format
+// Only the block format is implemented; there are no frame headers or checksums.
+int iLZ4CompressBound(int srcSize)
+{
+    return srcSize + srcSize / 255 + 16;
+}
+
+static void iLZ4WriteLength(unsigned char *&op, int length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+}
+
+// Greedy single-pass compressor. Returns the compressed size, or -1 if `dst` is too small.
+int iLZ4Compress(const unsigned char *src, int srcSize, unsigned char *dst, int dstCapacity)
+{
+    const int HASH_BITS = 14;
+    const int MIN_MATCH = 4;
+    const int LAST_LITERALS = 5; // The last 5 bytes are always literals.
+    const int MATCH_LIMIT = 12;  // The last match must start at least 12 bytes before the end.
+    static int table[1 << HASH_BITS];
+    for (int i = 0; i < (1 << HASH_BITS); i++)
+        table[i] = -1;
+
+    unsigned char *op = dst;
+    unsigned char *oend = dst + dstCapacity;
+    int anchor = 0;
+    int ip = 0;
+
+    while (ip < srcSize - MATCH_LIMIT)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, src + ip, 4);
+        int h = (int)((sequence * 2654435761u) >> (32 - HASH_BITS));
+        int ref = table[h];
+        table[h] = ip;
+
+        if (ref < 0 || ip - ref > 65535 || memcmp(src + ref, src + ip, 4) != 0)
+        {
+            ip++;
+            continue;
+        }
+
+        int matchLength = MIN_MATCH;
+        while (ip + matchLength < srcSize - LAST_LITERALS && src[ref + matchLength] == src[ip + matchLength])
+            matchLength++;
+
+        int literalLength = ip - anchor;
+        if (op + 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1 > oend)
+            return -1;
+
+        unsigned char *token = op++;
+        *token = (unsigned char)((literalLength >= 15 ? 15 : literalLength) << 4);
+        if (literalLength >= 15)
+            iLZ4WriteLength(op, literalLength - 15);
+        memcpy(op, src + anchor, literalLength);
+        op += literalLength;
+
+        int offset = ip - ref;
+        *op++ = (unsigned char)(offset & 0xFF);
+        *op++ = (unsigned char)(offset >> 8);
+
+        int extraLength = matchLength - MIN_MATCH;
+        *token |= (unsigned char)(extraLength >= 15 ? 15 : extraLength);
+        if (extraLength >= 15)
+            iLZ4WriteLength(op, extraLength - 15);
+
+        ip += matchLength;
+        anchor = ip;
+    }
+
+    int literalLength = srcSize - anchor;
+    if (op + 1 + literalLength / 255 + 1 + literalLength > oend)
+        return -1;
+    *op++ = (unsigned char)((literalLength >= 15 ? 15 : literalLength) << 4);
+    if (literalLength >= 15)
+        iLZ4WriteLength(op, literalLength - 15);
+    memcpy(op, src + anchor, literalLength);
+    op += literalLength;
+
+    return (int)(op - dst);
+}
+
+// Returns the decompressed size, or -1 if the input is malformed or `dst` is too small.
+int iLZ4Decompress(const unsigned char *src, int srcSize, unsigned char *dst, int dstCapacity)
+{
+    const unsigned char *ip = src;
+    const unsigned char *iend = src + srcSize;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + dstCapacity;
+
+    while (ip < iend)
+    {
+        unsigned token = *ip++;
+
+        int literalLength = token >> 4;
+        if (literalLength == 15)
+        {
+            unsigned char b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                literalLength += b;
+            } while (b == 255);
+        }
+        if (literalLength > iend - ip || literalLength > oend - op)
+            return -1;
+        memcpy(op, ip, literalLength);
+        op += literalLength;
+        ip += literalLength;
+
+        if (ip >= iend)
+            break; // The last sequence has no match.
+
+        if (iend - ip < 2)
+            return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - dst)
+            return -1;
+
+        int matchLength = token & 15;
+        if (matchLength == 15)
+        {
+            unsigned char b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                matchLength += b;
+            } while (b == 255);
+        }
+        matchLength += 4;
+        if (matchLength > oend - op)
+            return -1;
+
+        const unsigned char *match = op - offset;
+        if (offset >= matchLength)
+        {
+            memcpy(op, match, matchLength);
+            op += matchLength;
+        }
+        else
+        {
+            while (matchLength--) // Overlapping copy repeats the last `offset` bytes.
+                *op++ = *match++;
+        }
+    }
+    return (int)(op - dst);
+}
+
+// * Archive access
+void iClosePack()
+{
+    if (!iAssetPack.base)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(iAssetPack.base);
+    CloseHandle(iAssetPack.mapping);
+    CloseHandle(iAssetPack.file);
+#else
+    munmap(iAssetPack.base, iAssetPack.size);
+#endif
+    memset(&iAssetPack, 0, sizeof(iAssetPack));
+}
+
+// False if an entry reaches past the end of the archive, has no NUL-terminated name, or has a size that does not
+// match what it holds, so that nothing reads past the mapping.
+static bool iIsPackEntryValid(const PackEntry *entry, size_t packSize)
+{
+    if (!memchr(entry->name, '\0', MAX_PACK_NAME_LEN) || (size_t)entry->offset + entry->size > packSize)
+        return false;
+    if (entry->compression != PACK_RAW && entry->compression != PACK_LZ4)
+        return false;
+    if (entry->compression == PACK_RAW && entry->size != entry->rawSize)
+        return false;
+    if (entry->type == PACK_BLOB)
+        return true;
+    return entry->type == PACK_IMAGE && entry->width > 0 && entry->height > 0 && entry->channels >= 1 &&
+           entry->channels <= 4 && (uint64_t)entry->width * entry->height * entry->channels == entry->rawSize;
+}
+
+// Maps an archive into memory, read-only. Images that change their pixels copy them out of the mapping first
+// (see iOwnImageData). Returns false if the file is missing or invalid.
+bool iOpenPack(const char *path)
+{
+    iClosePack();
+
+    unsigned char *base = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    size = GetFileSize(file, NULL);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    base = (unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (base == NULL)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    iAssetPack.file = file;
+    iAssetPack.mapping = mapping;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    size = st.st_size;
+    void *view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return false;
+    base = (unsigned char *)view;
+#endif
+    iAssetPack.base = base;
+    iAssetPack.size = size;
+
+    const PackHeader *header = (const PackHeader *)base;
+    if (size < sizeof(PackHeader) || memcmp(header->magic, PACK_MAGIC, 4) != 0 || header->version != PACK_VERSION ||
+        header->indexOffset + (uint64_t)header->entryCount * sizeof(PackEntry) > size)
+    {
+        printf("ERROR: Invalid asset pack: %s\n", path);
+        iClosePack();
+        return false;
+    }
+    const PackEntry *entries = (const PackEntry *)(base + header->indexOffset);
+    for (uint32_t i = 0; i < header->entryCount; i++)
+    {
+        if (!iIsPackEntryValid(&entries[i], size))
+        {
+            printf("ERROR: Invalid entry %u in asset pack: %s\n", i, path);
+            iClosePack();
+            return false;
+        }
+    }
+    iAssetPack.entries = entries;
+    iAssetPack.entryCount = header->entryCount;
+    return true;
+}
+
+// Index of the first entry whose name is not less than `name`.
+int iLowerBoundPackEntry(const char *name)
+{
+    int low = 0, high = iAssetPack.entryCount;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (strcmp(iAssetPack.entries[mid].name, name) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+const PackEntry *iFindPackEntry(const char *path)
+{
+    if (!iAssetPack.base)
+        return nullptr;
+    char name[MAX_PACK_NAME_LEN];
+    iNormalizePackName(name, path);
+    int index = iLowerBoundPackEntry(name);
+    if (index < iAssetPack.entryCount && strcmp(iAssetPack.entries[index].name, name) == 0)
+        return &iAssetPack.entries[index];
+    return nullptr;
+}
+
+unsigned char *iPackEntryData(const PackEntry *entry)
+{
+    return iAssetPack.base + entry->offset;
+}
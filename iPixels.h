@@ -0,0 +1,489 @@
+/***
+ * iPixels.h: v0.1.0
+ * Pixel kernels for the image functions of iGraphics: in-place row mirroring, color keying, alpha mask
+ * extraction and nearest-neighbor upscaling, for RGB and RGBA rows, and the AND of two rows of 1-bit collision
+ * masks. Every kernel has a scalar version, specialized for the channel count,
+ * and the RGBA kernels have SSE2 and AVX2 versions. The fastest set that the CPU supports is picked at
+ * startup with CPUID, and every set gives exactly the same output.
+ * helpers/pixel_kernel_bench.cpp checks the SIMD kernels against the scalar ones and times them.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define I_PIXELS_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+enum PixelKernelLevel
+{
+    PIXEL_KERNELS_SCALAR,
+    PIXEL_KERNELS_SSE2,
+    PIXEL_KERNELS_AVX2,
+    PIXEL_KERNEL_LEVEL_COUNT
+};
+
+typedef struct
+{
+    const char *name;
+    void (*mirrorRowRGB)(unsigned char *row, int width);
+    void (*mirrorRowRGBA)(unsigned char *row, int width);
+    void (*colorKeyRGB)(unsigned char *row, int width, unsigned int color);
+    void (*colorKeyRGBA)(unsigned char *row, int width, unsigned int color);
+    void (*alphaMaskRGBA)(const unsigned char *row, int width, uint64_t *mask);
+    void (*scaleRowRGB)(const unsigned char *src, int srcWidth, unsigned char *dst, int factor);
+    void (*scaleRowRGBA)(const unsigned char *src, int srcWidth, unsigned char *dst, int factor);
+    int (*andMaskBits)(const uint64_t *a, int startA, const uint64_t *b, int startB, int count, bool isAnyEnough);
+} PixelKernels;
+
+// * Scalar kernels
+// Reverses the order of the pixels of a row, in place.
+template <int channels>
+static void iMirrorRowScalar(unsigned char *row, int width)
+{
+    unsigned char *left = row;
+    unsigned char *right = row + (size_t)(width - 1) * channels;
+    for (; left < right; left += channels, right -= channels)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            unsigned char swap = left[c];
+            left[c] = right[c];
+            right[c] = swap;
+        }
+    }
+}
+
+// Makes the pixels of `color` (0xRRGGBB) transparent, or black for RGB.
+template <int channels>
+static void iColorKeyScalar(unsigned char *row, int width, unsigned int color)
+{
+    unsigned char r = (color >> 16) & 0xFF;
+    unsigned char g = (color >> 8) & 0xFF;
+    unsigned char b = color & 0xFF;
+    for (int x = 0; x < width; x++, row += channels)
+    {
+        if (row[0] != r || row[1] != g || row[2] != b)
+            continue;
+        if (channels == 4)
+            row[3] = 0;
+        else
+            row[0] = row[1] = row[2] = 0;
+    }
+}
+
+// Sets bit x % 64 of mask[x / 64] if pixel x is not fully transparent. Writes all (width + 63) / 64 words.
+static void iAlphaMaskScalar(const unsigned char *row, int width, uint64_t *mask)
+{
+    memset(mask, 0, sizeof(uint64_t) * ((width + 63) / 64));
+    for (int x = 0; x < width; x++)
+    {
+        if (row[x * 4 + 3] != 0)
+            mask[x / 64] |= (uint64_t)1 << (x % 64);
+    }
+}
+
+// * Mask rows
+// A 1-bit mask row holds bit x % 64 of word x / 64 for pixel x, like the rows written by alphaMaskRGBA.
+static inline int iMaskWords(int width)
+{
+    return (width + 63) / 64;
+}
+
+// The `count` (1 to 64) bits of a mask row from bit `start`, in the lowest bits. Never reads past bit start + count.
+static inline uint64_t iMaskBits(const uint64_t *row, int start, int count)
+{
+    int word = start / 64, shift = start % 64;
+    uint64_t bits = row[word] >> shift;
+    if (shift + count > 64)
+        bits |= row[word + 1] << (64 - shift);
+    return count == 64 ? bits : bits & (((uint64_t)1 << count) - 1);
+}
+
+static inline uint64_t iReverseBits64(uint64_t bits)
+{
+    bits = ((bits >> 1) & 0x5555555555555555ULL) | ((bits & 0x5555555555555555ULL) << 1);
+    bits = ((bits >> 2) & 0x3333333333333333ULL) | ((bits & 0x3333333333333333ULL) << 2);
+    bits = ((bits >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((bits & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(bits);
+}
+
+// Writes the mask row of the mirrored row: bit x of `dst` is bit width - 1 - x of `src`.
+static inline void iReverseMaskBits(const uint64_t *src, int width, uint64_t *dst)
+{
+    for (int x = 0; x < width; x += 64)
+    {
+        int count = width - x < 64 ? width - x : 64;
+        dst[x / 64] = iReverseBits64(iMaskBits(src, width - x - count, count)) >> (64 - count);
+    }
+}
+
+// Counts the pixels set in both mask rows, over `count` pixels from pixel `startA` of `a` and `startB` of `b`.
+// With `isAnyEnough`, returns 1 at the first one instead.
+static int iAndMaskBitsScalar(const uint64_t *a, int startA, const uint64_t *b, int startB, int count, bool isAnyEnough)
+{
+    int total = 0;
+    for (int i = 0; i < count; i += 64)
+    {
+        int bitCount = count - i < 64 ? count - i : 64;
+        uint64_t both = iMaskBits(a, startA + i, bitCount) & iMaskBits(b, startB + i, bitCount);
+        if (both != 0 && isAnyEnough)
+            return 1;
+        total += __builtin_popcountll(both);
+    }
+    return total;
+}
+
+// Repeats every pixel of `src` `factor` times in `dst`, which holds srcWidth * factor pixels.
+template <int channels>
+static void iScaleRowScalar(const unsigned char *src, int srcWidth, unsigned char *dst, int factor)
+{
+    for (int x = 0; x < srcWidth; x++, src += channels)
+    {
+        for (int i = 0; i < factor; i++, dst += channels)
+        {
+            for (int c = 0; c < channels; c++)
+                dst[c] = src[c];
+        }
+    }
+}
+
+#ifdef I_PIXELS_X86
+// * SSE2 kernels
+// RGBA pixels are handled as 32-bit lanes: R in the lowest byte, A in the highest.
+#define I_RGB_BITS 0x00FFFFFF
+#define I_ALPHA_BITS ((int)0xFF000000)
+
+static inline int iPackRGB(unsigned int color) // 0xRRGGBB to the lane of the pixel in memory
+{
+    return (int)(((color >> 16) & 0xFF) | (color & 0xFF00) | ((color & 0xFF) << 16));
+}
+
+// Swaps blocks of pixels from both ends of the row, reversed, until they meet. The pixels left in the
+// middle are centered, so they are mirrored on their own.
+__attribute__((target("sse2"))) static void iMirrorRowRGBASSE2(unsigned char *row, int width)
+{
+    int left = 0, right = width - 4;
+    for (; left + 4 <= right; left += 4, right -= 4)
+    {
+        __m128i *leftPixels = (__m128i *)(row + (size_t)left * 4);
+        __m128i *rightPixels = (__m128i *)(row + (size_t)right * 4);
+        __m128i leftReversed = _mm_shuffle_epi32(_mm_loadu_si128(leftPixels), _MM_SHUFFLE(0, 1, 2, 3));
+        __m128i rightReversed = _mm_shuffle_epi32(_mm_loadu_si128(rightPixels), _MM_SHUFFLE(0, 1, 2, 3));
+        _mm_storeu_si128(leftPixels, rightReversed);
+        _mm_storeu_si128(rightPixels, leftReversed);
+    }
+    iMirrorRowScalar<4>(row + (size_t)left * 4, width - 2 * left);
+}
+
+__attribute__((target("sse2"))) static void iColorKeyRGBASSE2(unsigned char *row, int width, unsigned int color)
+{
+    const __m128i rgbBits = _mm_set1_epi32(I_RGB_BITS);
+    const __m128i alphaBits = _mm_set1_epi32(I_ALPHA_BITS);
+    const __m128i key = _mm_set1_epi32(iPackRGB(color));
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i *p = (__m128i *)(row + (size_t)x * 4);
+        __m128i pixels = _mm_loadu_si128(p);
+        __m128i isKey = _mm_cmpeq_epi32(_mm_and_si128(pixels, rgbBits), key);
+        _mm_storeu_si128(p, _mm_andnot_si128(_mm_and_si128(isKey, alphaBits), pixels));
+    }
+    iColorKeyScalar<4>(row + (size_t)x * 4, width - x, color);
+}
+
+__attribute__((target("sse2"))) static void iAlphaMaskRGBASSE2(const unsigned char *row, int width, uint64_t *mask)
+{
+    const __m128i alphaBits = _mm_set1_epi32(I_ALPHA_BITS);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 64 <= width; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 64; i += 4)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i *)(row + (size_t)(x + i) * 4));
+            __m128i isTransparent = _mm_cmpeq_epi32(_mm_and_si128(pixels, alphaBits), zero);
+            word |= (uint64_t)(~_mm_movemask_ps(_mm_castsi128_ps(isTransparent)) & 0xF) << i;
+        }
+        mask[x / 64] = word;
+    }
+    if (x < width)
+        iAlphaMaskScalar(row + (size_t)x * 4, width - x, mask + x / 64);
+}
+
+// Only the common factors 2 and 4 have fixed shuffles. The others are scalar without AVX2.
+__attribute__((target("sse2"))) static void iScaleRowRGBASSE2(const unsigned char *src, int srcWidth, unsigned char *dst, int factor)
+{
+    if (factor != 2 && factor != 4)
+    {
+        iScaleRowScalar<4>(src, srcWidth, dst, factor);
+        return;
+    }
+    int x = 0;
+    for (; x + 4 <= srcWidth; x += 4, dst += 16 * factor)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + (size_t)x * 4));
+        __m128i *out = (__m128i *)dst;
+        if (factor == 2)
+        {
+            _mm_storeu_si128(out, _mm_unpacklo_epi32(pixels, pixels));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(pixels, pixels));
+        }
+        else
+        {
+            _mm_storeu_si128(out, _mm_shuffle_epi32(pixels, _MM_SHUFFLE(0, 0, 0, 0)));
+            _mm_storeu_si128(out + 1, _mm_shuffle_epi32(pixels, _MM_SHUFFLE(1, 1, 1, 1)));
+            _mm_storeu_si128(out + 2, _mm_shuffle_epi32(pixels, _MM_SHUFFLE(2, 2, 2, 2)));
+            _mm_storeu_si128(out + 3, _mm_shuffle_epi32(pixels, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+    }
+    iScaleRowScalar<4>(src + (size_t)x * 4, srcWidth - x, dst, factor);
+}
+
+// * AVX2 kernels
+__attribute__((target("avx2"))) static void iMirrorRowRGBAAVX2(unsigned char *row, int width)
+{
+    const __m256i reversed = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    int left = 0, right = width - 8;
+    for (; left + 8 <= right; left += 8, right -= 8)
+    {
+        __m256i *leftPixels = (__m256i *)(row + (size_t)left * 4);
+        __m256i *rightPixels = (__m256i *)(row + (size_t)right * 4);
+        __m256i leftReversed = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(leftPixels), reversed);
+        __m256i rightReversed = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(rightPixels), reversed);
+        _mm256_storeu_si256(leftPixels, rightReversed);
+        _mm256_storeu_si256(rightPixels, leftReversed);
+    }
+    iMirrorRowRGBASSE2(row + (size_t)left * 4, width - 2 * left);
+}
+
+__attribute__((target("avx2"))) static void iColorKeyRGBAAVX2(unsigned char *row, int width, unsigned int color)
+{
+    const __m256i rgbBits = _mm256_set1_epi32(I_RGB_BITS);
+    const __m256i alphaBits = _mm256_set1_epi32(I_ALPHA_BITS);
+    const __m256i key = _mm256_set1_epi32(iPackRGB(color));
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i *p = (__m256i *)(row + (size_t)x * 4);
+        __m256i pixels = _mm256_loadu_si256(p);
+        __m256i isKey = _mm256_cmpeq_epi32(_mm256_and_si256(pixels, rgbBits), key);
+        _mm256_storeu_si256(p, _mm256_andnot_si256(_mm256_and_si256(isKey, alphaBits), pixels));
+    }
+    iColorKeyRGBASSE2(row + (size_t)x * 4, width - x, color);
+}
+
+__attribute__((target("avx2"))) static void iAlphaMaskRGBAAVX2(const unsigned char *row, int width, uint64_t *mask)
+{
+    const __m256i alphaBits = _mm256_set1_epi32(I_ALPHA_BITS);
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 64 <= width; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 64; i += 8)
+        {
+            __m256i pixels = _mm256_loadu_si256((const __m256i *)(row + (size_t)(x + i) * 4));
+            __m256i isTransparent = _mm256_cmpeq_epi32(_mm256_and_si256(pixels, alphaBits), zero);
+            word |= (uint64_t)(~_mm256_movemask_ps(_mm256_castsi256_ps(isTransparent)) & 0xFF) << i;
+        }
+        mask[x / 64] = word;
+    }
+    if (x < width)
+        iAlphaMaskScalar(row + (size_t)x * 4, width - x, mask + x / 64);
+}
+
+// Output vector i of a block of 8 source pixels takes lanes (i * 8 + lane) / factor, for factors up to 8.
+__attribute__((target("avx2"))) static void iScaleRowRGBAAVX2(const unsigned char *src, int srcWidth, unsigned char *dst, int factor)
+{
+    if (factor < 1 || factor > 8)
+    {
+        iScaleRowScalar<4>(src, srcWidth, dst, factor);
+        return;
+    }
+    __m256i lanes[8];
+    for (int i = 0; i < factor; i++)
+    {
+        int lane[8];
+        for (int j = 0; j < 8; j++)
+            lane[j] = (i * 8 + j) / factor;
+        lanes[i] = _mm256_loadu_si256((const __m256i *)lane);
+    }
+    int x = 0;
+    for (; x + 8 <= srcWidth; x += 8)
+    {
+        __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + (size_t)x * 4));
+        for (int i = 0; i < factor; i++, dst += 32)
+            _mm256_storeu_si256((__m256i *)dst, _mm256_permutevar8x32_epi32(pixels, lanes[i]));
+    }
+    iScaleRowScalar<4>(src + (size_t)x * 4, srcWidth - x, dst, factor);
+}
+
+// 256 bits of a mask row from bit `start`. The word after the last one is only read if `start` is not aligned.
+__attribute__((target("avx2"))) static inline __m256i iMaskBitsAVX2(const uint64_t *row, int start)
+{
+    const uint64_t *words = row + start / 64;
+    int shift = start % 64;
+    __m256i low = _mm256_loadu_si256((const __m256i *)words);
+    if (shift == 0)
+        return low;
+    __m256i high = _mm256_loadu_si256((const __m256i *)(words + 1));
+    return _mm256_or_si256(_mm256_srl_epi64(low, _mm_cvtsi32_si128(shift)), _mm256_sll_epi64(high, _mm_cvtsi32_si128(64 - shift)));
+}
+
+// Population count of every byte with a nibble lookup table, summed per 64-bit lane.
+__attribute__((target("avx2"))) static inline __m256i iPopCountAVX2(__m256i bits)
+{
+    const __m256i nibbleCounts = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibbles = _mm256_set1_epi8(0x0F);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(nibbleCounts, _mm256_and_si256(bits, lowNibbles)),
+                                     _mm256_shuffle_epi8(nibbleCounts, _mm256_and_si256(_mm256_srli_epi16(bits, 4), lowNibbles)));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+// 256 pixels per step, for wide masks. Rows of up to 64 pixels take the scalar path in a single step anyway.
+__attribute__((target("avx2"))) static int iAndMaskBitsAVX2(const uint64_t *a, int startA, const uint64_t *b, int startB, int count, bool isAnyEnough)
+{
+    __m256i totals = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 256 <= count; i += 256)
+    {
+        __m256i both = _mm256_and_si256(iMaskBitsAVX2(a, startA + i), iMaskBitsAVX2(b, startB + i));
+        if (isAnyEnough)
+        {
+            if (!_mm256_testz_si256(both, both))
+                return 1;
+            continue;
+        }
+        totals = _mm256_add_epi64(totals, iPopCountAVX2(both));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, totals);
+    int total = (int)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    if (i < count)
+    {
+        int rest = iAndMaskBitsScalar(a, startA + i, b, startB + i, count - i, isAnyEnough);
+        if (rest != 0 && isAnyEnough)
+            return 1;
+        total += rest;
+    }
+    return total;
+}
+#endif
+
+// * Dispatch
+// RGB rows have no SIMD kernels, as only the backgrounds are RGB and they are never transformed per frame.
+// Mask rows have no SSE2 kernel, as the scalar one already handles 64 pixels per step.
+static const PixelKernels iPixelKernelSets[PIXEL_KERNEL_LEVEL_COUNT] = {
+    {"scalar", iMirrorRowScalar<3>, iMirrorRowScalar<4>, iColorKeyScalar<3>, iColorKeyScalar<4>, iAlphaMaskScalar,
+     iScaleRowScalar<3>, iScaleRowScalar<4>, iAndMaskBitsScalar},
+#ifdef I_PIXELS_X86
+    {"SSE2", iMirrorRowScalar<3>, iMirrorRowRGBASSE2, iColorKeyScalar<3>, iColorKeyRGBASSE2, iAlphaMaskRGBASSE2,
+     iScaleRowScalar<3>, iScaleRowRGBASSE2, iAndMaskBitsScalar},
+    {"AVX2", iMirrorRowScalar<3>, iMirrorRowRGBAAVX2, iColorKeyScalar<3>, iColorKeyRGBAAVX2, iAlphaMaskRGBAAVX2,
+     iScaleRowScalar<3>, iScaleRowRGBAAVX2, iAndMaskBitsAVX2},
+#endif
+};
+
+// The highest PixelKernelLevel that the CPU (and, for AVX2, the OS) supports.
+int iDetectPixelKernelLevel()
+{
+#ifdef I_PIXELS_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & bit_SSE2))
+        return PIXEL_KERNELS_SCALAR;
+    bool isAVXEnabled = false;
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX))
+    {
+        unsigned int xcr0Low, xcr0High;
+        __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0)); // The OS saves the YMM registers
+        isAVXEnabled = (xcr0Low & 6) == 6;
+    }
+    if (isAVXEnabled && __get_cpuid_max(0, nullptr) >= 7)
+    {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if (ebx & bit_AVX2)
+            return PIXEL_KERNELS_AVX2;
+    }
+    return PIXEL_KERNELS_SSE2;
+#else
+    return PIXEL_KERNELS_SCALAR;
+#endif
+}
+
+PixelKernels iPixelKernels = iPixelKernelSets[iDetectPixelKernelLevel()];
+
+// Switches to another kernel set, e.g. to compare them. Returns false if the CPU does not support it.
+bool iUsePixelKernels(int level)
+{
+    if (level < 0 || level > iDetectPixelKernelLevel())
+        return false;
+    iPixelKernels = iPixelKernelSets[level];
+    return true;
+}
+
+// * Image-level helpers
+void iMirrorPixelRow(unsigned char *row, int width, int channels)
+{
+    if (channels == 4)
+        iPixelKernels.mirrorRowRGBA(row, width);
+    else
+        iPixelKernels.mirrorRowRGB(row, width);
+}
+
+void iColorKeyPixels(unsigned char *pixels, int count, int channels, unsigned int color)
+{
+    if (channels == 4)
+        iPixelKernels.colorKeyRGBA(pixels, count, color);
+    else
+        iPixelKernels.colorKeyRGB(pixels, count, color);
+}
+
+// Nearest-neighbor row for any ratio: pixel x samples the source pixel under its center.
+template <int channels>
+static void iNearestRow(const unsigned char *src, int srcWidth, unsigned char *dst, int width)
+{
+    for (int x = 0; x < width; x++, dst += channels)
+    {
+        const unsigned char *pixel = src + (size_t)((2 * x + 1) * (int64_t)srcWidth / (2 * width)) * channels;
+        for (int c = 0; c < channels; c++)
+            dst[c] = pixel[c];
+    }
+}
+
+// Resizes pixel art without blurring it: every pixel takes the color of the source pixel under its center.
+// Integer upscales repeat every pixel exactly `factor` times with the scale kernels, and every source row
+// is built once and copied for the rows that repeat it. `dst` must not overlap `src`.
+void iResizePixelsNearest(const unsigned char *src, int srcWidth, int srcHeight, unsigned char *dst, int width, int height, int channels)
+{
+    size_t srcRowSize = (size_t)srcWidth * channels;
+    size_t rowSize = (size_t)width * channels;
+    int factor = width % srcWidth == 0 ? width / srcWidth : 0;
+    int lastSrcY = -1;
+    for (int y = 0; y < height; y++)
+    {
+        unsigned char *row = dst + y * rowSize;
+        int srcY = (int)((2 * y + 1) * (int64_t)srcHeight / (2 * height));
+        if (srcY == lastSrcY)
+        {
+            memcpy(row, row - rowSize, rowSize);
+            continue;
+        }
+        lastSrcY = srcY;
+        const unsigned char *srcRow = src + srcY * srcRowSize;
+        if (factor == 1)
+            memcpy(row, srcRow, rowSize);
+        else if (factor > 1)
+            (channels == 4 ? iPixelKernels.scaleRowRGBA : iPixelKernels.scaleRowRGB)(srcRow, srcWidth, row, factor);
+        else if (channels == 4)
+            iNearestRow<4>(srcRow, srcWidth, row, width);
+        else
+            iNearestRow<3>(srcRow, srcWidth, row, width);
+    }
+}
@@ -0,0 +1,439 @@
+/***
+ * iProfiler.h: v0.1.0
+ * A small profiling helper for iGraphics programs.
+ * Provides a high resolution clock, nestable named profiling scopes, a startup report
+ * that breaks down where the time before the first presented frame was spent, and an
+ * allocation tracker that attributes heap allocations and GL textures to profiling scopes.
+ * Profiling is off by default and costs a single branch per scope until it is enabled.
+ * Define I_ALLOCATION_HOOKS before including this file to also track operator new/delete, which
+ * replaces the global ones.
+ */
+
+#pragma once
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define MAX_PROFILE_RECORDS 1024
+#define MAX_PROFILE_DEPTH 16
+#define MAX_PROFILE_LABEL_LEN 96
+
+typedef struct
+{
+    const char *category; // Static string, e.g. "phase" or "image".
+    char label[MAX_PROFILE_LABEL_LEN];
+    int depth; // Nesting depth of the scope when it was opened.
+    double startMs;
+    double durationMs; // -1 while the scope is still open.
+} ProfileRecord;
+
+typedef struct
+{
+    const char *label; // Only valid while the scope is open.
+    int record;        // Index into iProfileRecords, or -1 if the scope is not being recorded.
+} ProfileScope;
+
+bool iProfilerEnabled = false;
+ProfileRecord iProfileRecords[MAX_PROFILE_RECORDS];
+int iProfileRecordCount = 0;
+ProfileScope iProfileStack[MAX_PROFILE_DEPTH];
+int iProfileDepth = 0;
+
+bool iAllocTrackingEnabled = false;
+
+// Set on worker threads and while a background job runs (see iSubmitJob). Scopes and allocations
+// are only tracked on the main thread.
+thread_local bool iIsWorkerThread = false;
+
+// Startup report state
+double iStartupBudgetMs = 0; // 0 means report only, never fail.
+double iWindowReadyMs = -1;
+bool iFirstFramePresented = false;
+
+// Milliseconds elapsed since the first call. Call it once at the top of main() to fix the origin.
+// The first call must happen before other threads use it (iStartWorkers makes sure of that).
+double iGetTimeMs()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency, origin;
+    LARGE_INTEGER now;
+    if (frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&origin);
+    }
+    QueryPerformanceCounter(&now);
+    return (double)(now.QuadPart - origin.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+#else
+    static struct timespec origin = {0, 0};
+    struct timespec now;
+    if (origin.tv_sec == 0 && origin.tv_nsec == 0)
+        clock_gettime(CLOCK_MONOTONIC, &origin);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - origin.tv_sec) * 1000.0 + (now.tv_nsec - origin.tv_nsec) / 1000000.0;
+#endif
+}
+
+// Opens a profiling scope and returns a token for iProfileEnd(), or -1 when profiling is off.
+// Scopes are recorded for the startup report and used to attribute tracked allocations.
+int iProfileBegin(const char *category, const char *label)
+{
+    if ((!iProfilerEnabled && !iAllocTrackingEnabled) || iIsWorkerThread)
+        return -1;
+
+    int record = -1;
+    if (iProfilerEnabled && iProfileRecordCount < MAX_PROFILE_RECORDS)
+    {
+        record = iProfileRecordCount++;
+        ProfileRecord *r = &iProfileRecords[record];
+        r->category = category;
+        snprintf(r->label, sizeof(r->label), "%s", label);
+        r->depth = iProfileDepth;
+        r->startMs = iGetTimeMs();
+        r->durationMs = -1;
+    }
+
+    if (iProfileDepth < MAX_PROFILE_DEPTH)
+    {
+        iProfileStack[iProfileDepth].label = label;
+        iProfileStack[iProfileDepth].record = record;
+    }
+    return ++iProfileDepth;
+}
+
+void iProfileEnd(int token)
+{
+    if (token <= 0)
+        return;
+    iProfileDepth = token - 1;
+    if (iProfileDepth >= MAX_PROFILE_DEPTH)
+        return;
+
+    int record = iProfileStack[iProfileDepth].record;
+    if (record >= 0)
+        iProfileRecords[record].durationMs = iGetTimeMs() - iProfileRecords[record].startMs;
+}
+
+// Adds a record for work that was timed elsewhere, e.g. an image decoded on a worker thread.
+void iProfileRecord(const char *category, const char *label, double startMs, double durationMs)
+{
+    if (!iProfilerEnabled || iIsWorkerThread || iProfileRecordCount >= MAX_PROFILE_RECORDS)
+        return;
+    ProfileRecord *r = &iProfileRecords[iProfileRecordCount++];
+    r->category = category;
+    snprintf(r->label, sizeof(r->label), "%s", label);
+    r->depth = iProfileDepth;
+    r->startMs = startMs;
+    r->durationMs = durationMs;
+}
+
+int compareProfileRecordsByDuration(const void *a, const void *b)
+{
+    const ProfileRecord *recordA = *(const ProfileRecord **)a;
+    const ProfileRecord *recordB = *(const ProfileRecord **)b;
+    if (recordA->durationMs < recordB->durationMs)
+        return 1;
+    if (recordA->durationMs > recordB->durationMs)
+        return -1;
+    return 0;
+}
+
+// Prints every record of the given category, slowest first. `limit` caps the number of rows (-1 for all).
+void iPrintProfileBreakdown(const char *category, double totalMs, int limit = -1)
+{
+    const ProfileRecord *sorted[MAX_PROFILE_RECORDS];
+    int count = 0;
+    double sumMs = 0;
+    for (int i = 0; i < iProfileRecordCount; i++)
+    {
+        if (strcmp(iProfileRecords[i].category, category) == 0 && iProfileRecords[i].durationMs >= 0)
+        {
+            sorted[count++] = &iProfileRecords[i];
+            sumMs += iProfileRecords[i].durationMs;
+        }
+    }
+    qsort(sorted, count, sizeof(sorted[0]), compareProfileRecordsByDuration);
+
+    printf("  %-48s %10s %10s %7s\n", category, "at (ms)", "took (ms)", "share");
+    for (int i = 0; i < count && (limit < 0 || i < limit); i++)
+    {
+        printf("  %-48s %10.2f %10.2f %6.1f%%\n", sorted[i]->label, sorted[i]->startMs, sorted[i]->durationMs,
+               totalMs > 0 ? sorted[i]->durationMs * 100.0 / totalMs : 0.0);
+    }
+    if (limit >= 0 && count > limit)
+        printf("  ... %d more\n", count - limit);
+    printf("  %-48s %10s %10.2f (%d entries)\n", "sum", "", sumMs, count);
+}
+
+// Turns on profiling for the startup sequence. A positive budget makes the report fail when exceeded.
+void iEnableStartupReport(double budgetMs = 0)
+{
+    iGetTimeMs(); // Fix the clock origin.
+    iProfilerEnabled = true;
+    iStartupBudgetMs = budgetMs;
+}
+
+// Called by iGraphics once the window exists, right before the main loop starts.
+void iProfilerWindowReady()
+{
+    if (iProfilerEnabled)
+        iWindowReadyMs = iGetTimeMs();
+}
+
+// Called by iGraphics after the first frame has been presented. Prints the startup report and
+// exits with a non-zero status when the configured budget was exceeded.
+void iProfilerFirstFrame()
+{
+    if (iFirstFramePresented)
+        return;
+    iFirstFramePresented = true;
+    if (!iProfilerEnabled)
+        return;
+
+    double totalMs = iGetTimeMs();
+
+    printf("\n===== Startup report =====\n");
+    iPrintProfileBreakdown("phase", totalMs);
+    printf("\n");
+    iPrintProfileBreakdown("image", totalMs, 20);
+    printf("\n");
+    if (iWindowReadyMs >= 0)
+        printf("  Window ready -> first frame: %.2f ms\n", totalMs - iWindowReadyMs);
+    printf("  Time to first presented frame: %.2f ms\n", totalMs);
+
+    bool exceeded = iStartupBudgetMs > 0 && totalMs > iStartupBudgetMs;
+    if (iStartupBudgetMs > 0)
+        printf("  Budget: %.2f ms -> %s\n", iStartupBudgetMs, exceeded ? "EXCEEDED" : "OK");
+    printf("==========================\n");
+    fflush(stdout);
+
+    iProfilerEnabled = false;
+    exit(exceeded ? 1 : 0);
+}
+
+// * Allocation tracking
+#define MAX_ALLOC_SCOPES 64
+
+typedef struct
+{
+    char label[MAX_PROFILE_LABEL_LEN];
+    long allocations;
+    long frees;
+    long long bytes;
+    long texturesCreated;
+    long texturesDeleted;
+} AllocStats;
+
+// Stats of the frame that is being recorded, the last completed frame, and the current report window.
+AllocStats iAllocCurrentFrame;
+AllocStats iAllocLastFrame;
+AllocStats iAllocScopes[MAX_ALLOC_SCOPES]; // Per scope, accumulated over the report window.
+int iAllocScopeCount = 0;
+long iAllocWindowFrames = 0;
+long iAllocMaxFrameAllocations = 0;
+long iAllocTotalFrames = 0;
+int iAllocReportInterval = 0; // Frames between automatic reports, 0 for none.
+bool iAllocTrackingPaused = false;
+
+AllocStats *iGetAllocScope()
+{
+    const char *label = "(no scope)";
+    if (iProfileDepth > 0)
+        label = iProfileStack[(iProfileDepth <= MAX_PROFILE_DEPTH ? iProfileDepth : MAX_PROFILE_DEPTH) - 1].label;
+
+    for (int i = 0; i < iAllocScopeCount; i++)
+    {
+        if (strcmp(iAllocScopes[i].label, label) == 0)
+            return &iAllocScopes[i];
+    }
+    if (iAllocScopeCount == MAX_ALLOC_SCOPES)
+        return &iAllocScopes[MAX_ALLOC_SCOPES - 1]; // The last slot collects the overflow.
+
+    AllocStats *scope = &iAllocScopes[iAllocScopeCount++];
+    memset(scope, 0, sizeof(*scope));
+    snprintf(scope->label, sizeof(scope->label), "%s", iAllocScopeCount == MAX_ALLOC_SCOPES ? "(other scopes)" : label);
+    return scope;
+}
+
+void iTrackAllocation(size_t size)
+{
+    if (!iAllocTrackingEnabled || iAllocTrackingPaused || iIsWorkerThread)
+        return;
+    iAllocCurrentFrame.allocations++;
+    iAllocCurrentFrame.bytes += size;
+    AllocStats *scope = iGetAllocScope();
+    scope->allocations++;
+    scope->bytes += size;
+}
+
+void iTrackFree()
+{
+    if (!iAllocTrackingEnabled || iAllocTrackingPaused || iIsWorkerThread)
+        return;
+    iAllocCurrentFrame.frees++;
+    iGetAllocScope()->frees++;
+}
+
+// Called next to every glGenTextures/glDeleteTextures so that GPU allocations show up too.
+void iTrackTextureCreate()
+{
+    if (!iAllocTrackingEnabled || iAllocTrackingPaused || iIsWorkerThread)
+        return;
+    iAllocCurrentFrame.texturesCreated++;
+    iGetAllocScope()->texturesCreated++;
+}
+
+void iTrackTextureDelete()
+{
+    if (!iAllocTrackingEnabled || iAllocTrackingPaused || iIsWorkerThread)
+        return;
+    iAllocCurrentFrame.texturesDeleted++;
+    iGetAllocScope()->texturesDeleted++;
+}
+
+// malloc/realloc/free wrappers used by iGraphics and its bundled stb and nanosvg code.
+void *iTrackedMalloc(size_t size)
+{
+    iTrackAllocation(size);
+    return malloc(size);
+}
+
+void *iTrackedRealloc(void *ptr, size_t size)
+{
+    iTrackAllocation(size);
+    return realloc(ptr, size);
+}
+
+void iTrackedFree(void *ptr)
+{
+    if (ptr)
+        iTrackFree();
+    free(ptr);
+}
+
+int compareAllocStatsByAllocations(const void *a, const void *b)
+{
+    const AllocStats *statsA = (const AllocStats *)a;
+    const AllocStats *statsB = (const AllocStats *)b;
+    long countA = statsA->allocations + statsA->texturesCreated;
+    long countB = statsB->allocations + statsB->texturesCreated;
+    return (countA < countB) - (countA > countB);
+}
+
+// Starts a new report window, e.g. to leave warm-up frames out of the numbers.
+void iResetAllocStats()
+{
+    iAllocScopeCount = 0;
+    iAllocWindowFrames = 0;
+    iAllocMaxFrameAllocations = 0;
+}
+
+// Prints allocations per frame and per scope for the frames since the last report, then starts a new window.
+void iPrintAllocReport()
+{
+    iAllocTrackingPaused = true;
+    long frames = iAllocWindowFrames > 0 ? iAllocWindowFrames : 1;
+
+    long allocations = 0, textures = 0;
+    long long bytes = 0;
+    for (int i = 0; i < iAllocScopeCount; i++)
+    {
+        allocations += iAllocScopes[i].allocations;
+        textures += iAllocScopes[i].texturesCreated;
+        bytes += iAllocScopes[i].bytes;
+    }
+
+    printf("\n===== Allocation report (%ld frames) =====\n", iAllocWindowFrames);
+    printf("  Per frame: %.1f allocations (max %ld), %.1f KB, %.1f textures created\n",
+           (double)allocations / frames, iAllocMaxFrameAllocations, bytes / 1024.0 / frames, (double)textures / frames);
+    qsort(iAllocScopes, iAllocScopeCount, sizeof(AllocStats), compareAllocStatsByAllocations);
+    printf("  %-40s %10s %10s %12s %10s %10s\n", "scope", "allocs", "frees", "bytes", "tex new", "tex del");
+    for (int i = 0; i < iAllocScopeCount; i++)
+    {
+        const AllocStats *scope = &iAllocScopes[i];
+        printf("  %-40s %10ld %10ld %12lld %10ld %10ld\n", scope->label, scope->allocations, scope->frees,
+               scope->bytes, scope->texturesCreated, scope->texturesDeleted);
+    }
+    printf("==========================================\n");
+    fflush(stdout);
+
+    iResetAllocStats();
+    iAllocTrackingPaused = false;
+}
+
+// Turns on allocation tracking. With a positive interval a report is printed every `reportInterval` frames.
+void iEnableAllocTracking(int reportInterval = 0)
+{
+    iAllocTrackingEnabled = true;
+    iAllocReportInterval = reportInterval;
+}
+
+// Called by iGraphics after every presented frame. Everything allocated since the previous call counts
+// towards this frame, including the timer callbacks that ran in between.
+void iAllocFrameEnd()
+{
+    if (!iAllocTrackingEnabled)
+        return;
+    iAllocLastFrame = iAllocCurrentFrame;
+    memset(&iAllocCurrentFrame, 0, sizeof(iAllocCurrentFrame));
+    iAllocTotalFrames++;
+    iAllocWindowFrames++;
+    long allocations = iAllocLastFrame.allocations + iAllocLastFrame.texturesCreated;
+    if (allocations > iAllocMaxFrameAllocations)
+        iAllocMaxFrameAllocations = allocations;
+
+    if (iAllocReportInterval > 0 && iAllocWindowFrames >= iAllocReportInterval)
+        iPrintAllocReport();
+}
+
+#ifdef I_ALLOCATION_HOOKS
+void *operator new(size_t size)
+{
+    void *ptr = iTrackedMalloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return iTrackedMalloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return iTrackedMalloc(size ? size : 1);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    iTrackedFree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    iTrackedFree(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    iTrackedFree(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    iTrackedFree(ptr);
+}
+#endif
@@ -0,0 +1,421 @@
+/***
+ * iResource.h: v0.1.0
+ * A reference-counted resource cache for iGraphics programs.
+ * Resources (images, sprite frame sets, fonts, sounds...) are loaded by typed loaders that the other
+ * headers register, and are keyed by their path plus the parameters they were loaded with, so loading
+ * the same thing twice returns the same handle. Resources that nobody references stay cached until
+ * the memory budget is exceeded or their slots are needed, and then the least recently used ones are freed first.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "iProfiler.h"
+
+#define MAX_RESOURCES 512
+#define MAX_RESOURCE_TYPES 8
+#define MAX_RESOURCE_KEY_LEN 160
+#define RESOURCE_INDEX_SIZE 1024         // Power of two, twice MAX_RESOURCES so that lookups probe few entries
+#define RESOURCE_CHECK_INTERVAL_MS 500.0 // How often iAcquireCurrentResource checks whether a file changed
+
+typedef struct
+{
+    bool isUsed; // false if the slot is free
+    int type;
+    char key[MAX_RESOURCE_KEY_LEN]; // Path plus load parameters
+    unsigned int hash;
+    int pathLength; // The path is the first pathLength characters of the key.
+    int ignoreColor, width, height;
+    time_t modifiedTime; // Of the file at the path when it was loaded, 0 if it has no file
+    double checkedMs;    // When modifiedTime was last compared with the file
+    void *data;
+    int count; // Number of items in `data`, e.g. frames in a frame set
+    size_t cpuBytes, gpuBytes;
+    int refCount;
+    unsigned long long lastUsed;
+} Resource;
+
+typedef struct
+{
+    const char *name;
+    // Loads the resource at `path` into r->data (and r->count). Returns false on failure.
+    bool (*load)(Resource *r, const char *path, int ignoreColor, int width, int height);
+    void (*unload)(Resource *r);
+    // Updates r->cpuBytes and r->gpuBytes, for resources whose size changes after loading
+    // (e.g. images get their texture on first draw). Optional.
+    void (*measure)(Resource *r);
+    // Loads the resource again from its file, keeping r->data valid for whoever points into it. Optional.
+    bool (*reload)(Resource *r, const char *path, int ignoreColor, int width, int height);
+} ResourceType;
+
+ResourceType iResourceTypes[MAX_RESOURCE_TYPES];
+int iResourceTypeCount = 0;
+Resource iResources[MAX_RESOURCES];
+// Open-addressing hash index of the cached resources by key hash: handle + 1, 0 for an empty entry, or -1 for the
+// entry of a resource that was unloaded, which lookups probe past.
+int iResourceIndex[RESOURCE_INDEX_SIZE];
+int iResourceIndexDeletedCount = 0;
+unsigned long long iResourceClock = 0;
+size_t iResourceCpuBudget = 0; // 0 means unlimited
+size_t iResourceGpuBudget = 0;
+
+// Returns the type id to pass to iAcquireResource, or -1 if there are too many types.
+int iRegisterResourceType(const char *name, bool (*load)(Resource *, const char *, int, int, int),
+                          void (*unload)(Resource *), void (*measure)(Resource *) = nullptr,
+                          bool (*reload)(Resource *, const char *, int, int, int) = nullptr)
+{
+    if (iResourceTypeCount >= MAX_RESOURCE_TYPES)
+    {
+        printf("ERROR: Too many resource types, cannot register %s\n", name);
+        return -1;
+    }
+    ResourceType *type = &iResourceTypes[iResourceTypeCount];
+    type->name = name;
+    type->load = load;
+    type->unload = unload;
+    type->measure = measure;
+    type->reload = reload;
+    return iResourceTypeCount++;
+}
+
+// Sets how much memory unreferenced resources may keep. 0 means unlimited.
+void iSetResourceBudget(size_t cpuBytes, size_t gpuBytes)
+{
+    iResourceCpuBudget = cpuBytes;
+    iResourceGpuBudget = gpuBytes;
+}
+
+static unsigned int iHashResourceKey(const char *key)
+{
+    unsigned int hash = 2166136261u; // FNV-1a
+    for (; *key; key++)
+        hash = (hash ^ (unsigned char)*key) * 16777619u;
+    return hash;
+}
+
+static void iIndexResource(int handle)
+{
+    unsigned int i = iResources[handle].hash & (RESOURCE_INDEX_SIZE - 1);
+    while (iResourceIndex[i] > 0)
+        i = (i + 1) & (RESOURCE_INDEX_SIZE - 1);
+    if (iResourceIndex[i] < 0)
+        iResourceIndexDeletedCount--;
+    iResourceIndex[i] = handle + 1;
+}
+
+static void iRebuildResourceIndex()
+{
+    memset(iResourceIndex, 0, sizeof(iResourceIndex));
+    iResourceIndexDeletedCount = 0;
+    for (int i = 0; i < MAX_RESOURCES; i++)
+    {
+        if (iResources[i].isUsed)
+            iIndexResource(i);
+    }
+}
+
+static void iUnindexResource(int handle)
+{
+    unsigned int i = iResources[handle].hash & (RESOURCE_INDEX_SIZE - 1);
+    while (iResourceIndex[i] != 0 && iResourceIndex[i] != handle + 1)
+        i = (i + 1) & (RESOURCE_INDEX_SIZE - 1);
+    if (iResourceIndex[i] == 0)
+        return;
+    iResourceIndex[i] = -1;
+    iResourceIndexDeletedCount++;
+}
+
+static void iUnloadResource(Resource *r)
+{
+    iUnindexResource((int)(r - iResources));
+    iResourceTypes[r->type].unload(r);
+    memset(r, 0, sizeof(Resource));
+    // Unloaded entries lengthen the probes of every lookup that passes them, so they are cleared once there are many.
+    if (iResourceIndexDeletedCount > RESOURCE_INDEX_SIZE / 4)
+        iRebuildResourceIndex();
+}
+
+// The least recently used resource that nobody references, or nullptr.
+static Resource *iFindOldestUnusedResource()
+{
+    Resource *oldest = nullptr;
+    for (int i = 0; i < MAX_RESOURCES; i++)
+    {
+        Resource *r = &iResources[i];
+        if (r->isUsed && r->refCount == 0 && (!oldest || r->lastUsed < oldest->lastUsed))
+            oldest = r;
+    }
+    return oldest;
+}
+
+static time_t iGetModifiedTime(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_mtime : 0;
+}
+
+// Frees the least recently used unreferenced resources until the cache fits in the budget.
+void iTrimResources()
+{
+    size_t cpuBytes = 0, gpuBytes = 0;
+    for (int i = 0; i < MAX_RESOURCES; i++)
+    {
+        Resource *r = &iResources[i];
+        if (!r->isUsed)
+            continue;
+        if (iResourceTypes[r->type].measure)
+            iResourceTypes[r->type].measure(r);
+        cpuBytes += r->cpuBytes;
+        gpuBytes += r->gpuBytes;
+    }
+
+    while ((iResourceCpuBudget && cpuBytes > iResourceCpuBudget) || (iResourceGpuBudget && gpuBytes > iResourceGpuBudget))
+    {
+        Resource *oldest = iFindOldestUnusedResource();
+        if (!oldest)
+            break; // Everything left is still referenced.
+        cpuBytes -= oldest->cpuBytes;
+        gpuBytes -= oldest->gpuBytes;
+        iUnloadResource(oldest);
+    }
+}
+
+static void iMakeResourceKey(char *key, const char *path, int ignoreColor, int width, int height)
+{
+    snprintf(key, MAX_RESOURCE_KEY_LEN, "%s|%d|%d|%d", path, ignoreColor, width, height);
+}
+
+// Index of the cached resource with `key`, or -1.
+static int iLookupResource(int type, const char *key, unsigned int hash)
+{
+    for (unsigned int i = hash & (RESOURCE_INDEX_SIZE - 1); iResourceIndex[i] != 0; i = (i + 1) & (RESOURCE_INDEX_SIZE - 1))
+    {
+        if (iResourceIndex[i] < 0)
+            continue;
+        Resource *r = &iResources[iResourceIndex[i] - 1];
+        if (r->hash == hash && r->type == type && strcmp(r->key, key) == 0)
+            return iResourceIndex[i] - 1;
+    }
+    return -1;
+}
+
+// A free slot for a resource that is not cached yet. When every slot is taken, unloads the least recently used
+// resource that nobody references to free its slot. Returns -1 if every resource is referenced.
+static int iMakeRoomForResource()
+{
+    for (int i = 0; i < MAX_RESOURCES; i++)
+    {
+        if (!iResources[i].isUsed)
+            return i;
+    }
+    Resource *oldest = iFindOldestUnusedResource();
+    if (!oldest)
+        return -1;
+    iUnloadResource(oldest);
+    return (int)(oldest - iResources);
+}
+
+static int iRetainResource(int handle)
+{
+    iResources[handle].refCount++;
+    iResources[handle].lastUsed = ++iResourceClock;
+    return handle;
+}
+
+static void iStoreResource(Resource *r, int type, const char *key, unsigned int hash, const char *path, int ignoreColor, int width, int height)
+{
+    r->isUsed = true;
+    r->type = type;
+    snprintf(r->key, sizeof(r->key), "%s", key);
+    r->hash = hash;
+    r->pathLength = (int)strlen(path);
+    r->ignoreColor = ignoreColor;
+    r->width = width;
+    r->height = height;
+    r->modifiedTime = iGetModifiedTime(path);
+    r->checkedMs = iGetTimeMs();
+    r->refCount = 1;
+    r->lastUsed = ++iResourceClock;
+    if (iResourceTypes[type].measure)
+        iResourceTypes[type].measure(r);
+    iIndexResource((int)(r - iResources));
+}
+
+// Returns a handle to the resource of `type` at `path` loaded with the given parameters, loading it
+// if it is not cached yet. Every successful call must be matched by iReleaseResource.
+// Returns -1 if the resource fails to load.
+int iAcquireResource(int type, const char *path, int ignoreColor = -1, int width = -1, int height = -1)
+{
+    if (type < 0 || type >= iResourceTypeCount)
+        return -1;
+
+    char key[MAX_RESOURCE_KEY_LEN];
+    iMakeResourceKey(key, path, ignoreColor, width, height);
+    unsigned int hash = iHashResourceKey(key);
+    int handle = iLookupResource(type, key, hash);
+    if (handle >= 0)
+        return iRetainResource(handle);
+
+    int freeSlot = iMakeRoomForResource();
+    if (freeSlot < 0)
+    {
+        printf("ERROR: Too many resources, cannot load %s\n", path);
+        return -1;
+    }
+    Resource *r = &iResources[freeSlot];
+    memset(r, 0, sizeof(Resource));
+    r->type = type;
+    if (!iResourceTypes[type].load(r, path, ignoreColor, width, height))
+    {
+        memset(r, 0, sizeof(Resource));
+        return -1;
+    }
+    iStoreResource(r, type, key, hash, path, ignoreColor, width, height);
+
+    iTrimResources(); // Only loads add memory, so this is the place to enforce the budget.
+    return freeSlot;
+}
+
+// Like iAcquireResource, but never loads anything: returns -1 if the resource is not cached.
+int iFindResource(int type, const char *path, int ignoreColor = -1, int width = -1, int height = -1)
+{
+    if (type < 0 || type >= iResourceTypeCount)
+        return -1;
+    char key[MAX_RESOURCE_KEY_LEN];
+    iMakeResourceKey(key, path, ignoreColor, width, height);
+    int handle = iLookupResource(type, key, iHashResourceKey(key));
+    return handle >= 0 ? iRetainResource(handle) : -1;
+}
+
+// Adds a resource that was loaded elsewhere, e.g. on a worker thread, as if iAcquireResource had loaded it.
+// The cache takes ownership of `data`. If the resource is already cached (or every slot is referenced), `data` is
+// unloaded, and the cached handle (or -1) is returned.
+int iAddResource(int type, const char *path, void *data, int count, int ignoreColor = -1, int width = -1, int height = -1)
+{
+    if (type < 0 || type >= iResourceTypeCount)
+        return -1;
+
+    char key[MAX_RESOURCE_KEY_LEN];
+    iMakeResourceKey(key, path, ignoreColor, width, height);
+    unsigned int hash = iHashResourceKey(key);
+    int handle = iLookupResource(type, key, hash);
+    int freeSlot = handle < 0 ? iMakeRoomForResource() : -1;
+
+    if (handle >= 0 || freeSlot < 0)
+    {
+        Resource unused = {};
+        unused.type = type;
+        unused.data = data;
+        unused.count = count;
+        iResourceTypes[type].unload(&unused);
+        if (handle < 0)
+            printf("ERROR: Too many resources, cannot add %s\n", path);
+        return handle >= 0 ? iRetainResource(handle) : -1;
+    }
+
+    Resource *r = &iResources[freeSlot];
+    memset(r, 0, sizeof(Resource));
+    r->data = data;
+    r->count = count;
+    iStoreResource(r, type, key, hash, path, ignoreColor, width, height);
+
+    iTrimResources();
+    return freeSlot;
+}
+
+// Drops a reference. The resource stays cached until the budget needs its memory.
+void iReleaseResource(int handle)
+{
+    if (handle < 0 || handle >= MAX_RESOURCES || !iResources[handle].isUsed || iResources[handle].refCount <= 0)
+        return;
+    iResources[handle].refCount--;
+}
+
+void *iResourceData(int handle)
+{
+    if (handle < 0 || handle >= MAX_RESOURCES || !iResources[handle].isUsed)
+        return nullptr;
+    return iResources[handle].data;
+}
+
+int iResourceCount(int handle)
+{
+    if (handle < 0 || handle >= MAX_RESOURCES || !iResources[handle].isUsed)
+        return 0;
+    return iResources[handle].count;
+}
+
+// Frees every unreferenced resource of `type`, or of every type if `type` is -1.
+void iFreeUnusedResources(int type = -1)
+{
+    for (int i = 0; i < MAX_RESOURCES; i++)
+    {
+        Resource *r = &iResources[i];
+        if (r->isUsed && r->refCount == 0 && (type == -1 || r->type == type))
+            iUnloadResource(r);
+    }
+}
+
+// Reloads every cached resource that was loaded from `path`, or from a folder that contains `path` (e.g. a frame set
+// when one of its frames changes), in place, so handles and pointers to the data stay valid. Resources whose type
+// cannot reload are freed if they are unreferenced. Returns the number of resources that were reloaded.
+int iReloadResources(const char *path)
+{
+    int reloadedCount = 0;
+    int changedPathLength = (int)strlen(path);
+    for (int i = 0; i < MAX_RESOURCES; i++)
+    {
+        Resource *r = &iResources[i];
+        if (!r->isUsed || r->pathLength > changedPathLength || strncmp(r->key, path, r->pathLength) != 0)
+            continue;
+        char last = r->key[r->pathLength - 1];
+        char next = path[r->pathLength];
+        if (next != '\0' && next != '/' && last != '/')
+            continue; // Another file that starts with the same characters
+
+        char resourcePath[MAX_RESOURCE_KEY_LEN];
+        snprintf(resourcePath, sizeof(resourcePath), "%.*s", r->pathLength, r->key);
+        ResourceType *type = &iResourceTypes[r->type];
+        if (type->reload && type->reload(r, resourcePath, r->ignoreColor, r->width, r->height))
+        {
+            r->modifiedTime = iGetModifiedTime(resourcePath);
+            r->checkedMs = iGetTimeMs();
+            r->lastUsed = ++iResourceClock;
+            if (type->measure)
+                type->measure(r);
+            reloadedCount++;
+        }
+        else if (r->refCount == 0)
+            iUnloadResource(r);
+    }
+    return reloadedCount;
+}
+
+// Like iAcquireResource, but first reloads the resource if its file changed since it was loaded. For resources
+// that are looked up by path on every frame, e.g. by iShowImage. The file is checked at most every
+// RESOURCE_CHECK_INTERVAL_MS, so that a lookup does not cost a system call.
+int iAcquireCurrentResource(int type, const char *path, int ignoreColor = -1, int width = -1, int height = -1)
+{
+    int handle = iAcquireResource(type, path, ignoreColor, width, height);
+    if (handle < 0)
+        return handle;
+    Resource *r = &iResources[handle];
+    double now = iGetTimeMs();
+    if (now - r->checkedMs < RESOURCE_CHECK_INTERVAL_MS)
+        return handle;
+    r->checkedMs = now;
+    if (iGetModifiedTime(path) == r->modifiedTime)
+        return handle;
+
+    ResourceType *resourceType = &iResourceTypes[type];
+    if (resourceType->reload && resourceType->reload(r, path, ignoreColor, width, height))
+    {
+        if (resourceType->measure)
+            resourceType->measure(r);
+    }
+    r->modifiedTime = iGetModifiedTime(path); // Not retried every frame if the reload failed
+    return handle;
+}
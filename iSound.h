@@ -15,9 +15,54 @@
 #include <SDL.h>
 #include <SDL_mixer.h>
 #include <stdio.h>
+#include "iResource.h"
+#include "iGraphics.h" // Background jobs
 using namespace std;
 
-Mix_Chunk *channelChunks[8];
+// Sounds are cached by the resource manager (see iResource.h), so playing a sound again does not reload it.
+// Each channel holds a reference to the sound it plays. The finished callback runs on the audio thread,
+// so it only flags the channel, and the reference is dropped on the main thread.
+int channelSounds[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+volatile bool channelFinished[8];
+bool iSoundInitialized = false; // Sounds are not played until the audio device is open.
+
+bool iLoadSoundResource(Resource *r, const char *filename, int, int, int)
+{
+    Mix_Chunk *sound = Mix_LoadWAV(filename);
+    if (!sound)
+    {
+        printf("Failed to load sound: %s\n", Mix_GetError());
+        return false;
+    }
+    r->data = sound;
+    r->count = 1;
+    return true;
+}
+
+void iUnloadSoundResource(Resource *r)
+{
+    Mix_FreeChunk((Mix_Chunk *)r->data);
+}
+
+void iMeasureSoundResource(Resource *r)
+{
+    r->cpuBytes = ((Mix_Chunk *)r->data)->alen;
+}
+
+int iSoundResourceType = iRegisterResourceType("sound", iLoadSoundResource, iUnloadSoundResource, iMeasureSoundResource);
+
+void releaseFinishedChannels()
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        if (channelFinished[i] && channelSounds[i] >= 0)
+        {
+            iReleaseResource(channelSounds[i]);
+            channelSounds[i] = -1;
+        }
+        channelFinished[i] = false;
+    }
+}
 void iSetVolume(int channel, int volumePercent)
 {
     if (channel >= 0)
@@ -65,16 +110,18 @@ void iResumeSound(int channel)
 
 void channelFinishedCallback(int channel)
 {
-    Mix_Chunk *it = channelChunks[channel];
-    if (it != nullptr)
-        Mix_FreeChunk(it);
-    channelChunks[channel] = nullptr;
+    if (channel >= 0 && channel < 8)
+        channelFinished[channel] = true;
 }
 
 void iStopSound(int channel)
 {
-    Mix_HaltChannel(channel);         // stops sound playing on that channel
-    channelFinishedCallback(channel); // Free the sound chunk
+    if (!iSoundInitialized)
+        return;
+    Mix_HaltChannel(channel); // stops sound playing on that channel
+    if (channel >= 0 && channel < 8)
+        channelFinished[channel] = true;
+    releaseFinishedChannels(); // Release the sound
 }
 
 void iStopAllSounds()
@@ -82,53 +129,116 @@ void iStopAllSounds()
     Mix_HaltChannel(-1); // -1 means halt ALL channels
     for (int i = 0; i < 8; ++i)
     {
-        channelFinishedCallback(i);
+        channelFinished[i] = true;
     }
+    releaseFinishedChannels();
 }
 
 int iPlaySound(const char *filename, bool loop = false, int volume = 100) // If loop==true , then the audio will play again and again
 {
-    Mix_Chunk *sound = Mix_LoadWAV(filename);
-    if (!sound)
-    {
-        printf("Failed to load sound: %s\n", Mix_GetError());
+    if (!iSoundInitialized)
+        return -1; // e.g. still initializing, see iInitializeSoundAsync
+    releaseFinishedChannels();
+    int handle = iAcquireResource(iSoundResourceType, filename);
+    if (handle < 0)
         return -1;
-    }
+    Mix_Chunk *sound = (Mix_Chunk *)iResourceData(handle);
     int channel = Mix_PlayChannel(-1, sound, loop ? -1 : 0); // Play the sound
     if (channel == -1)
     {
         printf("Error playing sound: %s\n", Mix_GetError());
-        Mix_FreeChunk(sound);
+        iReleaseResource(handle);
         return -1;
     }
 
-    iSetVolume(channel, volume);    // Set the volume
-    channelChunks[channel] = sound; //
+    iSetVolume(channel, volume); // Set the volume
+    if (channel < 8)
+    {
+        // The channel was free, so the sound it played before has finished.
+        if (channelSounds[channel] >= 0)
+            iReleaseResource(channelSounds[channel]);
+        channelFinished[channel] = false;
+        channelSounds[channel] = handle;
+    }
     return channel;
 }
 
-void iInitializeSound()
+static bool iOpenAudio()
 {
     if (SDL_Init(SDL_INIT_AUDIO) < 0)
     {
         printf("SDL_Init failed: %s\n", SDL_GetError());
-        return;
+        return false;
     }
     if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0)
     {
         printf("SDL_mixer could not initialize! Mix_Error: %s\n", Mix_GetError());
-        return;
+        return false;
     }
     Mix_ChannelFinished(channelFinishedCallback);
+    return true;
 }
 
-void iFreeSound()
+void iInitializeSound()
 {
-    for (int i = 0; i < 8; ++i)
+    iSoundInitialized = iOpenAudio();
+}
+
+// * Background initialization
+// Decoding long sounds (e.g. music) takes a while, so it can run on a worker thread while the program starts.
+// SDL is only initialized on the main thread, so the audio device is opened before the decoding starts.
+// Until iFinishSoundInit, iPlaySound plays nothing.
+#define MAX_SOUND_PRELOADS 8
+
+typedef struct
+{
+    const char *filenames[MAX_SOUND_PRELOADS];
+    Mix_Chunk *sounds[MAX_SOUND_PRELOADS];
+    int count;
+    bool opened;
+} SoundInit;
+
+SoundInit iSoundInit;
+
+void iRunSoundInit(void *)
+{
+    for (int i = 0; i < iSoundInit.count; i++)
+        iSoundInit.sounds[i] = Mix_LoadWAV(iSoundInit.filenames[i]);
+}
+
+// Opens the audio device, then starts decoding the sounds in `filenames` in the background. The filenames must
+// stay valid until iFinishSoundInit. Returns a handle to pass to iFinishSoundInit, once iIsJobDone if it should
+// not block.
+int iInitializeSoundAsync(const char *const *filenames = nullptr, int count = 0)
+{
+    iSoundInit.opened = iOpenAudio();
+    iSoundInit.count = iSoundInit.opened ? mmin(count, MAX_SOUND_PRELOADS) : 0;
+    for (int i = 0; i < iSoundInit.count; i++)
+        iSoundInit.filenames[i] = filenames[i];
+    if (iSoundInit.count == 0)
+        return -1; // Nothing to decode
+    return iSubmitJob(iRunSoundInit, nullptr);
+}
+
+// Waits for iInitializeSoundAsync and caches the decoded sounds for iPlaySound. Returns false if there is no audio.
+bool iFinishSoundInit(int handle)
+{
+    iWaitJob(handle);
+    iSoundInitialized = iSoundInit.opened;
+    for (int i = 0; i < iSoundInit.count; i++)
     {
-        Mix_FreeChunk(channelChunks[i]);
-        channelChunks[i] = nullptr;
+        if (iSoundInit.sounds[i])
+            iReleaseResource(iAddResource(iSoundResourceType, iSoundInit.filenames[i], iSoundInit.sounds[i], 1));
+        else
+            printf("Failed to load sound: %s\n", iSoundInit.filenames[i]);
     }
+    return iSoundInitialized;
+}
+
+void iFreeSound()
+{
+    iStopAllSounds();
+    iFreeUnusedResources(iSoundResourceType);
     Mix_CloseAudio();
     SDL_Quit();
 }
\ No newline at end of file
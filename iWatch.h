@@ -0,0 +1,239 @@
+/***
+ * iWatch.h: v0.1.0
+ * File change notifications for iGraphics programs, to reload levels and assets while the program runs.
+ * Folders are watched recursively with inotify on Linux. Elsewhere, or if inotify is not available,
+ * the modification times of the files in the watched folders are polled instead.
+ * Call iPollFileChanges on the main thread, e.g. once per frame; it never blocks.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "iProfiler.h"
+
+#define MAX_WATCHED_FOLDERS 128
+#define MAX_WATCHED_FILES 1024
+#define MAX_WATCH_PATH_LEN 160
+#define MAX_FILE_CHANGES 64       // Changes reported by one iPollFileChanges call. The rest wait for the next call.
+#define WATCH_POLL_INTERVAL_MS 500 // How often the files are polled without inotify.
+
+typedef struct
+{
+    char path[MAX_WATCH_PATH_LEN];
+    int watch; // inotify watch descriptor
+} WatchedFolder;
+
+typedef struct
+{
+    char path[MAX_WATCH_PATH_LEN];
+    time_t modifiedTime;
+} WatchedFile;
+
+WatchedFolder iWatchedFolders[MAX_WATCHED_FOLDERS]; // Every watched folder and subfolder
+int iWatchedFolderCount = 0;
+char iWatchRoots[MAX_WATCHED_FOLDERS][MAX_WATCH_PATH_LEN]; // The folders passed to iWatchFolder
+int iWatchRootCount = 0;
+WatchedFile iWatchedFiles[MAX_WATCHED_FILES]; // Only used when polling
+int iWatchedFileCount = 0;
+int iWatchFd = -1;         // inotify instance, or -1 when polling
+double iLastWatchPollMs = 0;
+
+char iFileChanges[MAX_FILE_CHANGES][MAX_WATCH_PATH_LEN];
+int iFileChangeCount = 0;
+#ifdef __linux__
+// inotify events that were read but not handled yet, because the list of changes was full.
+char iWatchEvents[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+ssize_t iWatchEventsLength = 0;
+ssize_t iWatchEventsOffset = 0;
+#endif
+
+// Returns false if the list of changes is full, so the change has to be reported by a later call.
+static bool iAddFileChange(const char *path)
+{
+    // Editors often write a file more than once per save.
+    for (int i = 0; i < iFileChangeCount; i++)
+    {
+        if (strcmp(iFileChanges[i], path) == 0)
+            return true;
+    }
+    if (iFileChangeCount >= MAX_FILE_CHANGES)
+        return false;
+    snprintf(iFileChanges[iFileChangeCount++], MAX_WATCH_PATH_LEN, "%s", path);
+    return true;
+}
+
+// Joins a folder and a file name into `path`, which holds MAX_WATCH_PATH_LEN chars.
+// Returns false, and logs it if `isLogged`, if the result does not fit.
+static bool iJoinWatchPath(char *path, const char *folderPath, const char *name, bool isLogged)
+{
+    if (snprintf(path, MAX_WATCH_PATH_LEN, "%s/%s", folderPath, name) < MAX_WATCH_PATH_LEN)
+        return true;
+    if (isLogged)
+        printf("Cannot watch %s/%s: the path is too long\n", folderPath, name);
+    return false;
+}
+
+// Notes the modification time of a file, and reports it as changed if it differs from the last one.
+static void iUpdateWatchedFile(const char *path, time_t modifiedTime, bool isReported)
+{
+    for (int i = 0; i < iWatchedFileCount; i++)
+    {
+        if (strcmp(iWatchedFiles[i].path, path) != 0)
+            continue;
+        // The new time is only noted once the change is reported, so a change that did not fit is found again.
+        if (iWatchedFiles[i].modifiedTime != modifiedTime && iAddFileChange(path))
+            iWatchedFiles[i].modifiedTime = modifiedTime;
+        return;
+    }
+    if (iWatchedFileCount >= MAX_WATCHED_FILES || (isReported && !iAddFileChange(path)))
+        return;
+    snprintf(iWatchedFiles[iWatchedFileCount].path, MAX_WATCH_PATH_LEN, "%s", path);
+    iWatchedFiles[iWatchedFileCount++].modifiedTime = modifiedTime;
+}
+
+// Adds a folder and its subfolders to the inotify instance, or notes the files in them when polling.
+// `isReported` is false for the first scan, so the files that already exist are not reported as changed.
+static void iScanWatchedFolder(const char *folderPath, bool isReported)
+{
+    DIR *dir = opendir(folderPath);
+    if (!dir)
+        return;
+
+#ifdef __linux__
+    if (iWatchFd >= 0 && iWatchedFolderCount < MAX_WATCHED_FOLDERS)
+    {
+        WatchedFolder *folder = &iWatchedFolders[iWatchedFolderCount];
+        folder->watch = inotify_add_watch(iWatchFd, folderPath, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (folder->watch >= 0)
+        {
+            snprintf(folder->path, MAX_WATCH_PATH_LEN, "%s", folderPath);
+            iWatchedFolderCount++;
+        }
+    }
+#endif
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        char path[MAX_WATCH_PATH_LEN];
+        if (!iJoinWatchPath(path, folderPath, entry->d_name, iWatchFd >= 0 || !isReported)) // Logged once, not on every poll
+            continue;
+        struct stat st;
+        if (stat(path, &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            iScanWatchedFolder(path, isReported);
+        else if (iWatchFd < 0)
+            iUpdateWatchedFile(path, st.st_mtime, isReported);
+    }
+    closedir(dir);
+}
+
+// Starts watching a folder and its subfolders. Returns false if the folder does not exist.
+bool iWatchFolder(const char *folderPath)
+{
+    struct stat st;
+    if (stat(folderPath, &st) != 0 || !S_ISDIR(st.st_mode) || iWatchRootCount >= MAX_WATCHED_FOLDERS)
+    {
+        printf("Cannot watch %s\n", folderPath);
+        return false;
+    }
+
+#ifdef __linux__
+    if (iWatchRootCount == 0)
+    {
+        iWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (iWatchFd < 0)
+            printf("inotify is not available, polling for file changes instead\n");
+    }
+#endif
+    snprintf(iWatchRoots[iWatchRootCount++], MAX_WATCH_PATH_LEN, "%s", folderPath);
+    iScanWatchedFolder(folderPath, false);
+    iLastWatchPollMs = iGetTimeMs();
+    return true;
+}
+
+#ifdef __linux__
+// Stops when the list of changes is full, and continues with the rest of the events on the next call.
+static void iReadWatchEvents()
+{
+    while (iFileChangeCount < MAX_FILE_CHANGES)
+    {
+        if (iWatchEventsOffset >= iWatchEventsLength)
+        {
+            iWatchEventsOffset = 0;
+            iWatchEventsLength = read(iWatchFd, iWatchEvents, sizeof(iWatchEvents));
+            if (iWatchEventsLength <= 0)
+            {
+                iWatchEventsLength = 0;
+                return;
+            }
+        }
+
+        while (iWatchEventsOffset < iWatchEventsLength && iFileChangeCount < MAX_FILE_CHANGES)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)(iWatchEvents + iWatchEventsOffset);
+            iWatchEventsOffset += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0)
+                continue;
+            const char *folderPath = nullptr;
+            for (int i = 0; i < iWatchedFolderCount && !folderPath; i++)
+            {
+                if (iWatchedFolders[i].watch == event->wd)
+                    folderPath = iWatchedFolders[i].path;
+            }
+            // New folders are watched as well. A file is complete on IN_CLOSE_WRITE, unlike on IN_CREATE.
+            bool isFolder = event->mask & IN_ISDIR;
+            if (!folderPath || !(event->mask & (isFolder ? IN_CREATE | IN_MOVED_TO : IN_CLOSE_WRITE | IN_MOVED_TO)))
+                continue;
+
+            char path[MAX_WATCH_PATH_LEN];
+            if (!iJoinWatchPath(path, folderPath, event->name, true))
+                continue;
+            if (isFolder)
+                iScanWatchedFolder(path, true);
+            else
+                iAddFileChange(path);
+        }
+    }
+}
+#endif
+
+// Calls `onChange` with the path of every file in the watched folders that was written, added or replaced
+// since the last call, e.g. "assets/tiles/3.png". Returns the number of changed files.
+int iPollFileChanges(void (*onChange)(const char *path))
+{
+    if (iWatchRootCount == 0)
+        return 0;
+
+    iFileChangeCount = 0;
+#ifdef __linux__
+    if (iWatchFd >= 0)
+        iReadWatchEvents();
+#endif
+    if (iWatchFd < 0 && iGetTimeMs() - iLastWatchPollMs >= WATCH_POLL_INTERVAL_MS)
+    {
+        for (int i = 0; i < iWatchRootCount; i++)
+            iScanWatchedFolder(iWatchRoots[i], true);
+        if (iFileChangeCount < MAX_FILE_CHANGES)
+            iLastWatchPollMs = iGetTimeMs(); // Otherwise the next call scans again for the changes that did not fit.
+    }
+
+    // Reported after collecting, so that `onChange` may take its time or poll again.
+    int changeCount = iFileChangeCount;
+    char changes[MAX_FILE_CHANGES][MAX_WATCH_PATH_LEN];
+    memcpy(changes, iFileChanges, sizeof(changes[0]) * changeCount);
+    for (int i = 0; i < changeCount; i++)
+        onChange(changes[i]);
+    return changeCount;
+}
@@ -0,0 +1,519 @@
+/***
+ * levelFormat.h: v0.1.0
+ * The compiled level format of RETRO RACCOON, shared by the game and helpers/level_compiler.cpp.
+ * levels/levelN/level.bin holds a LevelFileHeader, the cells of every layer and precomputed row masks
+ * (colliders, coins, diamonds, lives and traps), laid out exactly as they are used in memory, so the
+ * game reads a level with a single fread and no parsing. Levels are compiled from the Tiled maps in
+ * level_editor/ (levelN.tmx and its tileset) by a single-pass parser for the subset of TMX the game uses,
+ * which is fast enough that the game compiles a map at load time when it is newer than its level.bin.
+ * Files are little-endian, like every platform the game is built for.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define LEVEL_MAGIC "RRLV"
+#define LEVEL_VERSION 1
+#define LEVEL_MAX_LAYERS 10
+#define LEVEL_MAX_ROWS 32
+#define LEVEL_MAX_COLUMNS 32 // A row mask has one bit per column.
+#define LEVEL_MAX_TILE_IDS 256
+#define LEVEL_MAX_BACKGROUND_LEN 48
+
+// A cell is 16 bits: the flip flags and the tile ID + 1, so that 0 is an empty cell.
+#define LEVEL_CELL_FLIPPED_HORIZONTALLY 0x8000
+#define LEVEL_CELL_FLIPPED_VERTICALLY 0x4000
+#define LEVEL_CELL_ID_MASK 0x3FFF
+
+// Flags of the global tile IDs (GIDs) in Tiled maps. GID 0 is an empty cell.
+#define TILED_FLIPPED_HORIZONTALLY 0x80000000u
+#define TILED_FLIPPED_VERTICALLY 0x40000000u
+#define TILED_GID_MASK 0x0FFFFFFFu // Also drops the diagonal and hexagonal flips, which the game does not support.
+
+// IDs of the special tiles.
+#define FLAG_ID 111
+#define COIN_ID 151
+#define DIAMOND_ID 67
+#define FULL_LIFE_ID 44
+#define NO_LIFE_ID 46
+
+const int trapIds[] = {68, 33, 34, 35, 53, 54, 55, 73, 74, 75}; // IDs of the tiles that are traps.
+
+enum LevelMask
+{
+    LEVEL_COLLIDE_MASK, // A tile in any layer is a collider.
+    LEVEL_COIN_MASK,
+    LEVEL_DIAMOND_MASK,
+    LEVEL_LIFE_MASK,
+    LEVEL_TRAP_MASK,
+    LEVEL_MASK_COUNT
+};
+
+typedef struct
+{
+    char magic[4]; // LEVEL_MAGIC
+    uint32_t version;
+    uint16_t columns, rows;
+    uint16_t layerCount;
+    uint16_t reserved;
+    char background[LEVEL_MAX_BACKGROUND_LEN]; // File name in assets/backgrounds
+    uint32_t usedTileIds[LEVEL_MAX_TILE_IDS / 32]; // Bit `id % 32` of word `id / 32` is set if any layer uses tile `id`.
+    // Followed by layerCount * rows * columns cells (top row first), padded to 4 bytes,
+    // and LEVEL_MASK_COUNT * rows row masks (bit `col` is set for column `col`).
+} LevelFileHeader;
+
+#define LEVEL_MAX_FILE_SIZE (sizeof(LevelFileHeader) + LEVEL_MAX_LAYERS * LEVEL_MAX_ROWS * LEVEL_MAX_COLUMNS * sizeof(uint16_t) + LEVEL_MASK_COUNT * LEVEL_MAX_ROWS * sizeof(uint32_t))
+
+// Room for the largest level, aligned for the row masks.
+typedef union
+{
+    LevelFileHeader header;
+    uint32_t words[LEVEL_MAX_FILE_SIZE / sizeof(uint32_t)];
+} LevelFile;
+
+size_t levelMasksOffset(const LevelFileHeader *header)
+{
+    size_t cellsEnd = sizeof(LevelFileHeader) + (size_t)header->layerCount * header->rows * header->columns * sizeof(uint16_t);
+    return (cellsEnd + 3) & ~(size_t)3;
+}
+
+size_t levelFileSize(const LevelFileHeader *header)
+{
+    return levelMasksOffset(header) + LEVEL_MASK_COUNT * header->rows * sizeof(uint32_t);
+}
+
+uint16_t *levelCells(LevelFile *file, int layer)
+{
+    const LevelFileHeader *header = &file->header;
+    return (uint16_t *)((char *)file + sizeof(LevelFileHeader)) + (size_t)layer * header->rows * header->columns;
+}
+
+uint32_t *levelMask(LevelFile *file, int mask)
+{
+    return (uint32_t *)((char *)file + levelMasksOffset(&file->header)) + (size_t)mask * file->header.rows;
+}
+
+bool isLevelTileUsed(const LevelFileHeader *header, int id)
+{
+    return id >= 0 && id < LEVEL_MAX_TILE_IDS && (header->usedTileIds[id / 32] >> (id % 32) & 1);
+}
+
+bool isTrap(int id)
+{
+    for (size_t i = 0; i < sizeof(trapIds) / sizeof(trapIds[0]); i++)
+    {
+        if (id == trapIds[i])
+            return true;
+    }
+    return false;
+}
+
+// Alternative tiles of the tileset that the game treats as one special tile.
+int remapTileId(int id)
+{
+    if (id == 152) // Alternative coins
+        return COIN_ID;
+    if (id == 112) // Alternative flags
+        return FLAG_ID;
+    if (id == 45 || id == 46) // Alternative lives
+        return FULL_LIFE_ID;
+    return id;
+}
+
+bool isValidLevelHeader(const LevelFileHeader *header)
+{
+    return memcmp(header->magic, LEVEL_MAGIC, 4) == 0 && header->version == LEVEL_VERSION &&
+           header->columns > 0 && header->columns <= LEVEL_MAX_COLUMNS && header->rows > 0 && header->rows <= LEVEL_MAX_ROWS &&
+           header->layerCount <= LEVEL_MAX_LAYERS;
+}
+
+// Clears `file` and fills in its header. Room for every layer is reserved until finishLevelFile,
+// as the number of layers is only known once the whole map is read.
+void initLevelFile(LevelFile *file, int columns, int rows)
+{
+    memset(file, 0, sizeof(LevelFile));
+    LevelFileHeader *header = &file->header;
+    memcpy(header->magic, LEVEL_MAGIC, 4);
+    header->version = LEVEL_VERSION;
+    header->columns = columns;
+    header->rows = rows;
+    header->layerCount = LEVEL_MAX_LAYERS;
+}
+
+// Moves the masks right after the last of the `layerCount` layers.
+void finishLevelFile(LevelFile *file, int layerCount)
+{
+    size_t masksSize = LEVEL_MASK_COUNT * file->header.rows * sizeof(uint32_t);
+    uint32_t *masks = levelMask(file, 0);
+    file->header.layerCount = layerCount;
+    memmove(levelMask(file, 0), masks, masksSize);
+    size_t size = levelFileSize(&file->header);
+    memset((char *)file + size, 0, sizeof(LevelFile) - size);
+}
+
+// Stores a tile in a cell, remapped like the game expects it, and updates the used tiles and the masks.
+// `id` is -1 for an empty cell.
+void setLevelCell(LevelFile *file, int layer, int row, int col, int id, bool isFlippedHorizontally, bool isFlippedVertically, bool doesCollide)
+{
+    uint16_t *cell = &levelCells(file, layer)[row * file->header.columns + col];
+    *cell = 0;
+    if (id < 0)
+        return;
+
+    id = remapTileId(id);
+    *cell = (uint16_t)(id + 1);
+    if (isFlippedHorizontally)
+        *cell |= LEVEL_CELL_FLIPPED_HORIZONTALLY;
+    if (isFlippedVertically)
+        *cell |= LEVEL_CELL_FLIPPED_VERTICALLY;
+    file->header.usedTileIds[id / 32] |= 1u << (id % 32);
+
+    uint32_t bit = 1u << col;
+    if (doesCollide)
+        levelMask(file, LEVEL_COLLIDE_MASK)[row] |= bit;
+    if (id == COIN_ID)
+        levelMask(file, LEVEL_COIN_MASK)[row] |= bit;
+    else if (id == DIAMOND_ID)
+        levelMask(file, LEVEL_DIAMOND_MASK)[row] |= bit;
+    else if (isTrap(id))
+        levelMask(file, LEVEL_TRAP_MASK)[row] |= bit;
+    else if (id == FULL_LIFE_ID)
+        levelMask(file, LEVEL_LIFE_MASK)[row] |= bit;
+}
+
+// * TMX parsing
+// Only the subset of TMX that the level editor produces is supported: the map size, a `background` map property,
+// tile layers with CSV data, and tilesets (embedded or in a .tsx file) with a `collides` tile property.
+// The file is read into one buffer and scanned once; attribute values are used in place, never copied.
+
+#define MAX_TMX_PATH_LEN 160
+
+typedef struct
+{
+    int firstGid; // 0 until the first tileset is read
+    unsigned int lastGid;
+    bool collides[LEVEL_MAX_TILE_IDS]; // The `collides` property of each tile
+} TmxTileset;
+
+// Reads a whole text file into a null-terminated buffer, to be freed with free(). Returns nullptr if it is missing.
+char *readTextFile(const char *path)
+{
+    FILE *textFile = fopen(path, "rb");
+    if (textFile == NULL)
+        return nullptr;
+    fseek(textFile, 0, SEEK_END);
+    long size = ftell(textFile);
+    fseek(textFile, 0, SEEK_SET);
+    char *text = (char *)malloc(size + 1);
+    size = (long)fread(text, 1, size, textFile);
+    text[size] = '\0';
+    fclose(textFile);
+    return text;
+}
+
+// true if the tag starting at `tag` ('<') is named `name`, e.g. "layer" or "/layer".
+bool isTmxTag(const char *tag, const char *name)
+{
+    size_t length = strlen(name);
+    char next = tag[length + 1];
+    return strncmp(tag + 1, name, length) == 0 && (next == ' ' || next == '>' || next == '/' || next == '\n' || next == '\r' || next == '\t');
+}
+
+// Returns the value of attribute `name` of the tag starting at `tag` and stores its length, or nullptr if the tag does not have it.
+const char *tmxAttribute(const char *tag, const char *name, int *length)
+{
+    size_t nameLength = strlen(name);
+    for (const char *p = tag + 1; *p && *p != '>'; p++)
+    {
+        if (*p != ' ' && *p != '\n' && *p != '\r' && *p != '\t')
+            continue;
+        const char *value = p + 1 + nameLength + 2;
+        if (strncmp(p + 1, name, nameLength) == 0 && p[1 + nameLength] == '=' && p[2 + nameLength] == '"')
+        {
+            const char *valueEnd = strchr(value, '"');
+            if (valueEnd == NULL)
+                return nullptr;
+            *length = (int)(valueEnd - value);
+            return value;
+        }
+    }
+    return nullptr;
+}
+
+int tmxIntAttribute(const char *tag, const char *name, int defaultValue)
+{
+    int length;
+    const char *value = tmxAttribute(tag, name, &length);
+    return value ? atoi(value) : defaultValue;
+}
+
+bool isTmxAttribute(const char *tag, const char *name, const char *expectedValue)
+{
+    int length;
+    const char *value = tmxAttribute(tag, name, &length);
+    return value && length == (int)strlen(expectedValue) && strncmp(value, expectedValue, length) == 0;
+}
+
+// Reads the `collides` property of the <tile> elements from `p` to the end of the tileset.
+void readTmxTileProperties(const char *p, TmxTileset *tileset)
+{
+    int tileId = -1;
+    for (p = strchr(p, '<'); p; p = strchr(p + 1, '<'))
+    {
+        if (isTmxTag(p, "/tileset"))
+            break;
+        if (isTmxTag(p, "tile"))
+            tileId = tmxIntAttribute(p, "id", -1);
+        else if (isTmxTag(p, "/tile"))
+            tileId = -1;
+        else if (isTmxTag(p, "property") && tileId >= 0 && tileId < LEVEL_MAX_TILE_IDS && isTmxAttribute(p, "name", "collides"))
+            tileset->collides[tileId] = isTmxAttribute(p, "value", "true");
+    }
+}
+
+// Reads the first tileset of a map, from the <tileset> tag at `tag` or the .tsx file it refers to.
+bool readTmxTileset(const char *tag, const char *mapPath, TmxTileset *tileset)
+{
+    tileset->firstGid = tmxIntAttribute(tag, "firstgid", 1);
+    tileset->lastGid = TILED_GID_MASK;
+    int sourceLength;
+    const char *source = tmxAttribute(tag, "source", &sourceLength);
+    if (source == NULL)
+    {
+        readTmxTileProperties(tag + 1, tileset); // Embedded tileset
+        return true;
+    }
+
+    // The source is relative to the map.
+    const char *mapFileName = strrchr(mapPath, '/');
+    int folderLength = mapFileName ? (int)(mapFileName - mapPath + 1) : 0;
+    char tilesetPath[MAX_TMX_PATH_LEN];
+    snprintf(tilesetPath, sizeof(tilesetPath), "%.*s%.*s", folderLength, mapPath, sourceLength, source);
+    char *tsx = readTextFile(tilesetPath);
+    if (tsx == NULL)
+    {
+        printf("%s file not found\n", tilesetPath);
+        return false;
+    }
+    readTmxTileProperties(tsx, tileset);
+    free(tsx);
+    return true;
+}
+
+// Decodes the CSV data of a layer, starting at `p`, into `layer` of `file`. Returns the end of the data.
+const char *readTmxLayerData(const char *p, LevelFile *file, int layer, const TmxTileset *tileset, const char *mapPath)
+{
+    int columns = file->header.columns;
+    int cellCount = columns * file->header.rows;
+    int cellIndex = 0;
+    while (*p && *p != '<')
+    {
+        if (*p < '0' || *p > '9')
+        {
+            p++;
+            continue;
+        }
+        uint32_t gid = 0;
+        while (*p >= '0' && *p <= '9')
+            gid = gid * 10 + (uint32_t)(*p++ - '0');
+        if (cellIndex >= cellCount)
+        {
+            cellIndex++;
+            continue;
+        }
+
+        uint32_t baseGid = gid & TILED_GID_MASK;
+        int id = -1;
+        if (baseGid != 0 && (baseGid < (uint32_t)tileset->firstGid || baseGid > tileset->lastGid || baseGid - tileset->firstGid >= LEVEL_MAX_TILE_IDS))
+            printf("%s: Tile %u of layer %d is not in the first tileset, treated as empty\n", mapPath, baseGid, layer);
+        else if (baseGid != 0)
+            id = (int)(baseGid - tileset->firstGid);
+        setLevelCell(file, layer, cellIndex / columns, cellIndex % columns, id, (gid & TILED_FLIPPED_HORIZONTALLY) != 0,
+                     (gid & TILED_FLIPPED_VERTICALLY) != 0, id >= 0 && tileset->collides[id]);
+        cellIndex++;
+    }
+    if (cellIndex != cellCount)
+        printf("%s: Layer %d has %d tiles instead of %d\n", mapPath, layer, cellIndex, cellCount);
+    return p;
+}
+
+// Compiles the Tiled map at `mapPath` into `file`. Layers are stacked in the order of the map, like Tiled draws them.
+bool compileTmxLevel(const char *mapPath, LevelFile *file)
+{
+    char *tmx = readTextFile(mapPath);
+    if (tmx == NULL)
+    {
+        printf("%s file not found\n", mapPath);
+        return false;
+    }
+
+    TmxTileset tileset = {};
+    bool isMapRead = false;
+    bool isRead = true;
+    int layerCount = 0;
+    int depth = 0; // Number of open elements
+    for (const char *p = strchr(tmx, '<'); p && isRead; p = strchr(p + 1, '<'))
+    {
+        if (p[1] == '?' || p[1] == '!')
+            continue;
+        if (p[1] == '/')
+        {
+            depth--;
+            continue;
+        }
+        const char *tagEnd = strchr(p, '>');
+        bool isSelfClosing = tagEnd && tagEnd[-1] == '/';
+
+        if (isTmxTag(p, "map"))
+        {
+            int columns = tmxIntAttribute(p, "width", 0);
+            int rows = tmxIntAttribute(p, "height", 0);
+            if (isTmxAttribute(p, "infinite", "1") || columns <= 0 || columns > LEVEL_MAX_COLUMNS || rows <= 0 || rows > LEVEL_MAX_ROWS)
+            {
+                printf("%s: Only finite maps up to %d x %d tiles are supported\n", mapPath, LEVEL_MAX_COLUMNS, LEVEL_MAX_ROWS);
+                isRead = false;
+            }
+            initLevelFile(file, columns, rows);
+            isMapRead = true;
+        }
+        else if (!isMapRead)
+        {
+            // Nothing but the map is expected at the top level.
+        }
+        else if (isTmxTag(p, "property") && depth == 2 && isTmxAttribute(p, "name", "background"))
+        {
+            int length;
+            const char *background = tmxAttribute(p, "value", &length);
+            if (background == NULL || length >= LEVEL_MAX_BACKGROUND_LEN)
+            {
+                printf("%s: The background property is missing a file name or it is too long\n", mapPath);
+                isRead = false;
+            }
+            else
+                snprintf(file->header.background, LEVEL_MAX_BACKGROUND_LEN, "%.*s", length, background);
+        }
+        else if (isTmxTag(p, "tileset"))
+        {
+            int firstGid = tmxIntAttribute(p, "firstgid", 1);
+            if (tileset.firstGid == 0)
+                isRead = readTmxTileset(p, mapPath, &tileset);
+            else if (firstGid > tileset.firstGid && (unsigned int)firstGid <= tileset.lastGid)
+                tileset.lastGid = firstGid - 1; // Only the first tileset is in assets/tiles/.
+        }
+        else if (isTmxTag(p, "data"))
+        {
+            if (layerCount >= LEVEL_MAX_LAYERS)
+            {
+                printf("%s: Only %d layers are supported\n", mapPath, LEVEL_MAX_LAYERS);
+                isRead = false;
+            }
+            else if (!isTmxAttribute(p, "encoding", "csv"))
+            {
+                printf("%s: Set the tile layer format of the map to CSV\n", mapPath);
+                isRead = false;
+            }
+            else if (!isSelfClosing && tagEnd)
+            {
+                p = readTmxLayerData(tagEnd + 1, file, layerCount++, &tileset, mapPath) - 1;
+                depth++;
+                continue;
+            }
+        }
+
+        if (!isSelfClosing)
+            depth++;
+    }
+    free(tmx);
+
+    if (isRead && file->header.background[0] == '\0')
+    {
+        printf("%s: The map has no background property\n", mapPath);
+        isRead = false;
+    }
+    if (!isMapRead)
+        printf("%s is not a Tiled map\n", mapPath);
+    if (!isRead || !isMapRead)
+        return false;
+    finishLevelFile(file, layerCount);
+    return true;
+}
+
+#define LEVEL_FILE_PATH "levels/level%d/level.bin"
+#define LEVEL_MAP_PATH "level_editor/level%d.tmx"
+#define LEVEL_TILESET_PATH "level_editor/tilesets/tileset1.tsx" // The tileset of every level map
+
+// Compiles level N from level_editor/levelN.tmx.
+bool compileLevel(int level, LevelFile *file)
+{
+    char mapPath[MAX_TMX_PATH_LEN];
+    sprintf(mapPath, LEVEL_MAP_PATH, level);
+    return compileTmxLevel(mapPath, file);
+}
+
+// true if levels/levelN/level.bin is newer than level_editor/levelN.tmx and the tileset, or there is no map
+// to compile (e.g. in a release build).
+bool isLevelCompiled(int level)
+{
+    char levelPath[MAX_TMX_PATH_LEN], mapPath[MAX_TMX_PATH_LEN];
+    sprintf(levelPath, LEVEL_FILE_PATH, level);
+    sprintf(mapPath, LEVEL_MAP_PATH, level);
+    struct stat levelStat, mapStat, tilesetStat;
+    if (stat(levelPath, &levelStat) != 0)
+        return false;
+    if (stat(mapPath, &mapStat) != 0)
+        return true;
+    // Modification times may only have a precision of seconds, so a map saved in the same second is compiled again.
+    return levelStat.st_mtime > mapStat.st_mtime && (stat(LEVEL_TILESET_PATH, &tilesetStat) != 0 || levelStat.st_mtime > tilesetStat.st_mtime);
+}
+
+// Reads level N into `file`: levels/levelN/level.bin, or level_editor/levelN.tmx if the map has changed since.
+bool readLevelFile(int level, LevelFile *file)
+{
+    if (!isLevelCompiled(level))
+        return compileLevel(level, file);
+
+    char path[MAX_TMX_PATH_LEN];
+    sprintf(path, LEVEL_FILE_PATH, level);
+    FILE *levelFile = fopen(path, "rb");
+    if (levelFile == NULL)
+    {
+        printf("%s file not found\n", path);
+        return false;
+    }
+    size_t size = fread(file, 1, sizeof(LevelFile), levelFile);
+    fclose(levelFile);
+    if (size < sizeof(LevelFileHeader) || !isValidLevelHeader(&file->header) || size != levelFileSize(&file->header))
+    {
+        printf("%s is not a valid level file, recompile it with helpers/level_compiler.cpp\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Reads only the header of level N, e.g. to find out which tiles it uses.
+bool readLevelHeader(int level, LevelFileHeader *header)
+{
+    if (isLevelCompiled(level))
+    {
+        char path[MAX_TMX_PATH_LEN];
+        sprintf(path, LEVEL_FILE_PATH, level);
+        FILE *levelFile = fopen(path, "rb");
+        if (levelFile == NULL)
+            return false;
+        bool isRead = fread(header, sizeof(LevelFileHeader), 1, levelFile) == 1 && isValidLevelHeader(header);
+        fclose(levelFile);
+        return isRead;
+    }
+
+    LevelFile *file = (LevelFile *)malloc(sizeof(LevelFile));
+    bool isRead = compileLevel(level, file);
+    if (isRead)
+        *header = file->header;
+    free(file);
+    return isRead;
+}
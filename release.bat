@@ -46,6 +46,26 @@ if %ERRORLEVEL% neq 0 (
 
 echo Finished building.
 
+REM Pack the images and fonts into assets\assets.pack, so that the release build does not decode PNGs at startup
+g++.exe -O2 -I. -IOpenGL\\include helpers\\asset_packer.cpp -o bin\\asset_packer.exe
+
+if %ERRORLEVEL% neq 0 (
+    echo Building the asset packer failed.
+    exit /b 1
+)
+
+bin\asset_packer.exe
+
+REM Compile the levels into levels\levelN\level.bin, so that the game loads them without parsing
+g++.exe -O2 -I. helpers\\level_compiler.cpp -o bin\\level_compiler.exe
+
+if %ERRORLEVEL% neq 0 (
+    echo Building the level compiler failed.
+    exit /b 1
+)
+
+bin\level_compiler.exe
+
 REM Copy all DLL files from bin to release folder
 xcopy /y /q "bin\*.dll" "%RELEASE_DIR%\"
 